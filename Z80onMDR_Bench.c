@@ -0,0 +1,196 @@
+// Z80onMDR_Bench - timings for the Z80onMDR_Lite compression & snapshot kernels
+// Copyright (c) 2021, Tom Dalby
+// 
+// Z80onMDR_Lite is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Z80onMDR_Lite is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Z80onMDR_Lite. If not, see <http://www.gnu.org/licenses/>.
+//
+// ===============================================================
+// build: gcc -O2 -pthread -o z80onmdr_bench Z80onMDR_Bench.c
+// usage: z80onmdr_bench [kernel]
+//   times each kernel on the same synthetic inputs every run and prints one JSON object per line, e.g.
+//   {"kernel":"zxsc","input":"random","bytes":16384,"runs":12,"ns_per_byte":1234.5,"size":16899}
+//   size is the compressed size where there is one, otherwise 0. Give a kernel name to only run that one
+#define Z80ONMDR_LIB
+#include "Z80onMDR_Lite.c"
+#define BENCH_TIME 0.2 // seconds to run each one for
+// inputs are made from a fixed seed so every run & every build times the same data
+struct zxbench {
+	const char* name;
+	unsigned char mem[16384];
+	int size;
+	int screen; // 1 if a screen (6912 bytes)
+};
+unsigned int benchrand(unsigned int* seed);
+void benchinputs(struct zxbench* in);
+int benchrle(unsigned char* in, int size, unsigned char* out);
+void benchprint(const char* kernel, struct zxbench* in, int runs, double secs, unsigned long size);
+int main(int argc, char* argv[]) {
+	struct zxbench in[5];
+	struct zxmatch mt;
+	struct zxhash hash;
+	struct zxin zin;
+	unsigned char* store, * rle, * lin, out[16384], scrlinear[6912];
+	const char* only = argc > 1 ? argv[1] : NULL;
+	int i, j, runs, rlesize;
+	unsigned long size;
+	double start;
+	if ((store = (unsigned char*)malloc(16384 * 2)) == NULL) error(8);
+	if ((rle = (unsigned char*)malloc(16384 * 2)) == NULL) error(8);
+	benchinputs(in);
+	for (i = 0; i < 5; i++) {
+		lin = in[i].mem; // match finder works on the screen in its linear order
+		if (in[i].screen) {
+			for (j = 0; j < 6912; j++) scrlinear[j] = in[i].mem[zxorder[j]];
+			lin = scrlinear;
+		}
+		// compress, default & optimal parsers
+		if (only == NULL || strcmp(only, "zxsc") == 0) {
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				size = zxsc(in[i].mem, store, in[i].size, in[i].screen, NULL, PARSE_GREEDY, 0);
+			}
+			benchprint("zxsc", &in[i], runs, zxclock() - start, size);
+		}
+		// quickest compression level
+		if (only == NULL || strcmp(only, "zxsc1") == 0) {
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				size = zxsc(in[i].mem, store, in[i].size, in[i].screen, NULL, PARSE_GREEDY, 1);
+			}
+			benchprint("zxsc1", &in[i], runs, zxclock() - start, size);
+		}
+		if (only == NULL || strcmp(only, "zxscoptimal") == 0) {
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				size = zxsc(in[i].mem, store, in[i].size, in[i].screen, NULL, PARSE_OPTIMAL, 0);
+			}
+			benchprint("zxscoptimal", &in[i], runs, zxclock() - start, size);
+		}
+		// match finder over the whole block, the screen is searched in its linear order
+		if (only == NULL || strcmp(only, "findmatch2") == 0) {
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				if (zxhashbuild(&hash, lin, in[i].size)) error(8);
+				for (j = 1; j < in[i].size; j++) findmatch2(lin, &lin[j], in[i].size, &hash);
+				free(hash.bucket);
+				free(hash.first);
+				free(hash.pos);
+			}
+			benchprint("findmatch2", &in[i], runs, zxclock() - start, 0);
+		}
+		// match table kept between calls with one byte changed each time, as the delta loop does
+		if (only == NULL || strcmp(only, "zxmatches") == 0) {
+			memset(&mt, 0, sizeof(mt));
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				lin[in[i].size - 1 - runs % 64] ^= 1;
+				if (zxmatches(&mt, lin, in[i].size, in[i].screen, 0)) error(8);
+			}
+			benchprint("zxmatches", &in[i], runs, zxclock() - start, 0);
+			zxmatchfree(&mt);
+			benchinputs(in); // put back the changed bytes
+			if (in[i].screen) for (j = 0; j < 6912; j++) scrlinear[j] = in[i].mem[zxorder[j]];
+		}
+		// screen layout, attr then the 8 pixel rows under it
+		if (in[i].screen && (only == NULL || strcmp(only, "zxorder") == 0)) {
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				for (j = 0; j < 6912; j++) out[j] = in[i].mem[zxorder[j]];
+			}
+			benchprint("zxorder", &in[i], runs, zxclock() - start, 0);
+		}
+		// check the compressed block fits when decompressed in place
+		if (only == NULL || strcmp(only, "decompressf") == 0) {
+			size = zxsc(in[i].mem, store, in[i].size, 0, NULL, PARSE_GREEDY, 0);
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				decompressf(store, size, in[i].size);
+			}
+			benchprint("decompressf", &in[i], runs, zxclock() - start, size);
+		}
+		// z80 snapshot block, timed per decompressed byte
+		if (only == NULL || strcmp(only, "dcz80") == 0) {
+			rlesize = benchrle(in[i].mem, in[i].size, rle);
+			zin.buf = rle;
+			zin.size = rlesize;
+			for (runs = 0, start = zxclock(); runs == 0 || zxclock() - start < BENCH_TIME; runs++) {
+				zin.pos = 0;
+				if (dcz80(&zin, out, in[i].size, rlesize) != in[i].size) error(7);
+			}
+			benchprint("dcz80", &in[i], runs, zxclock() - start, rlesize);
+		}
+	}
+	free(store);
+	free(rle);
+	return 0;
+}
+unsigned int benchrand(unsigned int* seed) {
+	*seed = *seed * 1103515245 + 12345;
+	return *seed >> 16;
+}
+// zero page, random page, repeated pattern page, typical code/data page & a screen of text with a few attrs
+void benchinputs(struct zxbench* in) {
+	unsigned int seed = 2021;
+	int i, j, c, k;
+	in[0].name = "zero";
+	memset(in[0].mem, 0, 16384);
+	in[1].name = "random";
+	for (i = 0; i < 16384; i++) in[1].mem[i] = benchrand(&seed);
+	in[2].name = "pattern";
+	for (i = 0; i < 16384; i++) in[2].mem[i] = "\x18\x3c\x7e\xff\x7e\x3c\x18\x00\xaa\x55\xaa"[i % 11];
+	in[3].name = "mixed"; // runs, copies of earlier data & some random, roughly like code & game data
+	for (i = 0; i < 16384; i += j) {
+		j = 8 + benchrand(&seed) % 120;
+		if (i + j > 16384) j = 16384 - i;
+		if ((c = benchrand(&seed) % 3) == 1 && i <= 4096) c = 2; // nothing far enough back to copy yet, random instead
+		switch (c) {
+		case 0: memset(&in[3].mem[i], benchrand(&seed), j); break;
+		case 1: // forward a byte at a time, a copy from closer than j repeats like an lz match
+			c = i - 1 - benchrand(&seed) % 4096;
+			for (k = 0; k < j; k++) in[3].mem[i + k] = in[3].mem[c + k];
+			break;
+		default: for (k = 0; k < j; k++) in[3].mem[i + k] = benchrand(&seed);
+		}
+	}
+	in[4].name = "screen"; // 8x8 font from the pattern rows, text on every 3rd row, blank rows & a border of attrs
+	memset(in[4].mem, 0, 6912);
+	for (i = 0; i < 768; i++) {
+		if ((i / 32) % 3 == 0) {
+			for (j = 0; j < 8; j++) in[4].mem[ZXO_PIX(i, j)] = in[1].mem[(i % 37) * 8 + j] & 0x7e;
+		}
+		in[4].mem[6144 + i] = (i % 32 == 0 || i % 32 == 31) ? 0x28 : 0x38 + (i / 256);
+	}
+	for (i = 0; i < 4; i++) {
+		in[i].size = 16384;
+		in[i].screen = 0;
+	}
+	in[4].size = 6912;
+	in[4].screen = 1;
+}
+// z80 snapshot block compression, runs of 5 or more (or 2 0xed) as ed ed count byte
+int benchrle(unsigned char* in, int size, unsigned char* out) {
+	int i = 0, j, n = 0;
+	while (i < size) {
+		for (j = i; j < size && j - i < 255 && in[j] == in[i]; j++);
+		if (j - i >= 5 || (in[i] == 0xed && j - i >= 2)) {
+			out[n++] = 0xed;
+			out[n++] = 0xed;
+			out[n++] = j - i;
+			out[n++] = in[i];
+			i = j;
+		}
+		else if (in[i] == 0xed) {
+			out[n++] = in[i++];
+			if (i < size) out[n++] = in[i++]; // byte after a single 0xed is never part of a run
+		}
+		else out[n++] = in[i++];
+	}
+	return n;
+}
+void benchprint(const char* kernel, struct zxbench* in, int runs, double secs, unsigned long size) {
+	fprintf(stdout, "{\"kernel\":\"%s\",\"input\":\"%s\",\"bytes\":%d,\"runs\":%d,\"ns_per_byte\":%.3f,\"size\":%lu}\n",
+		kernel, in->name, in->size, runs, secs * 1e9 / ((double)runs * in->size), size);
+}
@@ -18,6 +18,41 @@
 // ===============================================================
 // usage: z80onmdr_lite snapshot.z80 
 //   this will create a mdr cartridge image called snapshot.mdr
+//   -o use the older in-screen launcher
+//   -x use the exact optimal parser, slower but never bigger than the default and reports the bytes saved
+//   -f parse for the shortest time to load & unpack rather than the smallest size
+//   -1 to -9 compression level, -1 is the quickest with a small window, few candidates & no cost to end refinement,
+//      -9 the default searches the whole window. The cartridge loads the same way whatever the level
+//   -j n compress the 128k pages on n threads while the main block & screen are done (build with -pthread on non-Windows)
+//   -c folder keep the compressed blocks in this folder & reuse them when the same screen, page or main block comes
+//      up again, -m n limits the folder to n MB (64 if not given) by removing the least recently used
+//   -g n leave n extra sectors after each file (2 was always used before), otherwise each gap is worked out from how long the
+//      Spectrum is busy between the two LOADs
+//   -k n try n launcher placements & starting deltas at once (one on each -j thread) & keep the smallest main block,
+//      never bigger than without it
+//   -v read the cartridge back, check every checksum & unpack each file to compare with the snapshot (always on with -b)
+//   --stats write the time taken by each stage & the compression counters to stderr as one line of JSON
+//   -n name name the cartridge from this rather than the snapshot's file name
+// usage: z80onmdr_lite - [-sna|-z80] [-n name]
+//   reads the snapshot from stdin & writes the cartridge to stdout, with the progress & any error on stderr. The
+//   format is worked out from the size (49179, 131103 or 147487 bytes is a .sna) unless -sna or -z80 is given, the
+//   cartridge is named "stdin" unless -n is given
+// usage: z80onmdr_lite -b [snapshots/folders] 
+//   batch mode, converts each snapshot listed & every .z80/.sna in each folder listed. With none listed it reads the
+//   list from stdin one per line. -j n converts n at a time, -o & -x are used for every one
+// usage: z80onmdr_lite -s snapshots
+//   puts up to 9 snapshots of one game on one cartridge named after the first sharing their screens & 128k pages, RUN
+//   starts the first & LOAD *"m";1;"run2" the second etc. A screen or 128k page that is the same as an earlier
+//   snapshot's is only stored once, otherwise if patching the first snapshot's is smaller only the bytes that differ
+//   are stored. Main blocks aren't shared, each is stored in full so a set of 48k snapshots saves little more than the
+//   screens
+// usage: z80onmdr_lite -p snapshots
+//   packs different games, 48k or 128k, onto as few cartridges as they fit on (game1.mdr, game1_2.mdr...). RUN shows
+//   a menu of the games on the cartridge & a key loads one. Each game's files follow on from the last game's so
+//   loading one never waits for another's, biggest first as it gets the sectors nearest to how they would be alone
+// usage: z80onmdr_lite -t cartridges.mdr
+//   estimates the seconds from RUN to the game starting for cartridges made by this, without the real hardware, or
+//   from choosing each one on the menu for -p
 // 
 // error codes
 // E01 - argument not a z80 file
@@ -34,14 +69,66 @@
 // E12 - stack clashes with launcher
 // E13 - program counter clashes with launcher
 // E14 - SNA snapshot issue
+// E15 - cartridge not made by Z80onMDR (-t)
+// E16 - snapshots for one cartridge have to be all 48k or all 128k & no more than 9 (-s)
+// E17 - cartridge doesn't read back the same as the snapshot (-v)
+// E18 - cannot create cache folder (-c)
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#include <process.h>
+#include <sys/utime.h>
+#include <io.h>
+#include <fcntl.h>
+#include <direct.h>
+#define PSAPI_VERSION 2 // peak memory call is in kernel32 so nothing extra to link
+#include <psapi.h>
+#else
+#include <pthread.h>
+#include <dirent.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#include <utime.h>
+#endif
+// x86 builds get SSE2 & AVX2 match length kernels, the one to use is picked when the CPU is checked
+#if (defined(__GNUC__) || defined(_MSC_VER)) && (defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86))
+#define ZXSIMD
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define ZXTARGET(t)
+#else
+#define ZXTARGET(t) __attribute__((target(t)))
+#endif
+#endif
+#include "Z80onMDR_Lite.h"
 #define VERSION_NUM "v2.0"
 #define PROGNAME "Z80onMDR_lite"
 #define B_GAP 128
 #define MAXLENGTH 256
 #define MINLENGTH 3
+#define MAXOFFSET 7936
+#define HASHBITS 12
+#define MAXTHREADS 64
+#define ZXSETMAX 9 // snapshots on one cartridge, run to run9
+#define ZXERRMAX 18 // highest error code, E18
+#define ZXSNAPMAX (1L << 20) // biggest snapshot read from stdin
+#define ZXMENULEN 512 // most the menu BASIC can be
+#define ZXCACHEVER 1 // change if the compressor output changes so old cache entries are no longer found
+#define ZXCACHEMAX (64L << 20) // default cache size limit in bytes
+// microdrive timings for the file gaps & load time estimate, the tape passes the sectors in order 254 down to 1. The
+// motor is turned off at the end of each LOAD and the tape runs on, slowing down, until it stops or the next LOAD
+#define ZXMDRLOOP 7.5 // seconds for the whole tape loop to go past the head
+#define ZXMDRPROC 0.012 // ROM checking & storing a sector before it can read the next, less than a sector so a gap of 1 is enough
+#define ZXMDRBASIC 0.02 // BASIC running the next LOAD & the ROM opening the file
+#define ZXMDRSTOP 0.15 // seconds for the tape to stop once the motor is off
+#define ZXTSTATES 3500000.0 // Z80 T-states per second
+#define ZXMDRBYTE (ZXMDRLOOP / 254.0 * 2.0 / 512.0 * ZXTSTATES) // T-states to load a byte, a 512 byte record every 2 sectors
 //v1 initial release based on v1.9b Z80onMDR
 //v1.1 added file interleaving, required removal of direct writing to output file
 //v1.1a improved file interleaving further by adding additional space between files
@@ -63,55 +150,417 @@ typedef union {
 	unsigned long int rrrr; //byte number
 	unsigned char r[4]; //split number into 4 8bit bytes in case of overflow
 } rrrr;
+struct zxhash;
+// snapshot being read from memory, reads past the end give EOF the same as reading a file
+struct zxin {
+	const unsigned char* buf;
+	int size;
+	int pos;
+};
+// longest match & offset for each byte of a block. This is kept between calls when the same block is compressed
+// again with only a few bytes changed (the delta loop) so only the bytes whose window covers a change are searched again
+struct zxmatch {
+	unsigned char* prev; // copy of the block from last time
+	unsigned short* length;
+	unsigned short* offset;
+	int* dirty; // marks where the search has to be redone
+	int size; // size of the block last time, 0 if nothing to reuse
+	int max; // space allocated
+	unsigned long compare; // match finder candidates looked at, added to on every search
+};
+// hash chains for the faster levels, each position is linked to the last one with the same hash as it is added so
+// the nearest are looked at first & the search can stop after a few
+struct zxchain {
+	int* head; // last position added under each hash, -1 for none
+	int* prev; // position before it under the same hash
+	int window, chain, nice; // from the compression level
+	int (*matchlen)(const unsigned char* a, const unsigned char* b, int max);
+	unsigned long compare; // candidates looked at
+};
+// independent block compression, these can be run at the same time on a small thread pool
+struct zxjob {
+	unsigned char* fload; // block to compress
+	unsigned char* store; // where to store it
+	int filesize;
+	int screen;
+	int parse;
+	int level;
+	unsigned long len; // compressed size once done
+	unsigned long greedy; // size with the default parser, only found for PARSE_OPTIMAL
+	double time, gtime; // seconds taken by each
+	unsigned long compare; // match finder candidates looked at
+	const char* cache; // cache folder or NULL
+	int cached; // 1 if it came from the cache
+};
+// one go at fitting the launcher in & compressing the main block, round the delta loop until the unpacker no longer
+// runs into the bytes it hasn't unpacked yet. -k runs several with different gaps & starting deltas at once
+struct zxmainjob {
+	unsigned char* main; // 1st 48k of the snapshot
+	struct zxrun* run; // indexed runs the gap is picked from
+	int nrun;
+	int rank; // 0 for the longest gap, 1 for the next...
+	int delta; // starting delta, the final one once done
+	int oldl, stackpos, stkpos, startpos, mainsize, parse, level;
+	const unsigned char* stk; // noc_launchstk
+	unsigned char igp[25], prt[54]; // noc_launchigp & noc_launchprt, jumps & sizes set for this go
+	const char* cache;
+	unsigned char* main48k; // 49152 bytes, launcher added
+	unsigned char* comp; // main block is compressed to comp + 8704
+	struct zxmatch* mt;
+	struct zxstats* st;
+	int igppos, chr, stshift; // where the gap code went, its clear byte & stack code shift
+	unsigned long cmsize; // compressed size without the launcher
+	int adder; // launcher bytes added in front
+	int err; // 0 if ok otherwise the error code
+};
+// maximal run of one byte value in memory, all the runs are indexed in one pass to find the biggest gap for the launcher
+struct zxrun {
+	int start; // position of first byte
+	int len;
+	unsigned char byte;
+};
+// tokens in compressed blocks, match lengths are counted in groups 3,4,5,6,7,8,9-16,17-32,33-64,65-128,129+
+#define ZXHIST 11
+struct zxtok {
+	unsigned long lit; // literal runs
+	unsigned long litbytes;
+	unsigned long match;
+	unsigned long longmatch; // 9+ which have the extra length byte
+	unsigned long matchbytes;
+	unsigned long hist[ZXHIST];
+};
+// what each token costs when parsing, in bytes for PARSE_OPTIMAL or T-states for PARSE_TSTATE. Also used for the unpack
+// times, which leave out byte
+struct zxcost {
+	int lit; // each literal run
+	int litbyte; // each byte in a literal run
+	int match; // each match
+	int longmatch; // extra for a 9+ match
+	int matchbyte; // each byte a match copies
+	int byte; // each byte stored
+};
+static const struct zxcost zxcostsize = { 0, 0, 0, 0, 0, 1 };
+static const struct zxcost zxcostlinear = { 42, 21, 224, 8, 21, (int)(ZXMDRBYTE + 0.5) }; // unpack & noc_launchprt
+static const struct zxcost zxcostscreen = { 60, 100, 150, 0, 160, (int)(ZXMDRBYTE + 0.5) }; // scrload works out each screen address
+// where the time goes in one conversion, written out as JSON with --stats
+#define ZXSEARCHMAX 16 // most -k goes at the main block
+#define ZXSTATCALL (B_GAP + 16) // zxsc calls timed, main is compressed once each time round the delta loop
+struct zxstats {
+	double header, decomp, gap, delta, pagewait, assembly, verify; // seconds in each stage
+	int ndelta; // times round the delta loop
+	int ncall;
+	struct {
+		char block[12];
+		double time;
+		int in;
+		unsigned long out;
+		int cached;
+	} call[ZXSTATCALL]; // each zxsc call in order
+	unsigned long compare; // match finder candidates looked at
+	struct zxtok tok; // tokens of the blocks written to the cartridge
+};
+struct zxpool {
+	void* job; // njob jobs each size bytes
+	int size;
+	void (*run)(struct zxpool* pool, void* job); // does one job
+	int njob; // number of jobs
+	int next; // next job to hand out
+	int nthread; // worker threads started
+#ifdef _WIN32
+	CRITICAL_SECTION lock;
+	HANDLE thread[MAXTHREADS];
+#else
+	pthread_mutex_t lock;
+	pthread_t thread[MAXTHREADS];
+#endif
+};
+// cartridge being built, sectors in use are kept in a bitmap so finding the next free one doesn't look at the image
+struct zxcart {
+	unsigned char* image; // MDRSIZE bytes
+	unsigned char sector; // where the next sector will be written, 254 down to 1
+	unsigned char used[32]; // bit for each sector number in use
+	unsigned char blank[543]; // blank sector with the cartridge name, stamped out for every sector
+};
+// cartridge of several snapshots of one game, kept between z80onmdr() calls
+struct zxset {
+	int n; // snapshots on the cartridge so far
+	int otek; // 128k, all have to be the same
+	struct zxcart mdr; // where the next file goes
+	unsigned char* block[ZXSETMAX]; // each snapshot's screen & 128k pages
+	unsigned char file[ZXSETMAX][6]; // file each of those is loaded from, 0 if it is patched
+	unsigned char next; // next file name
+	int games; // 1 for different games from z80onmdrpack(), nothing is shared & they are run1 to run9 after the menu
+};
+// cache entry found when tidying the cache folder
+struct zxcachefile {
+	char name[32];
+	long size;
+	long long time; // last used
+};
+// batch mode, the list of snapshots to convert which the workers take one at a time
+struct zxbatch {
+	char** file;
+	int* err; // result for each
+	int nfile;
+	int max; // space allocated
+	int next; // next to hand out
+	struct zxopt opt; // same settings for every one
+};
+// batch worker, keeps its buffers from one snapshot to the next
+struct zxbatchjob {
+	struct zxbatch* batch;
+	unsigned char* snap;
+	int snapmax;
+	unsigned char* cart;
+};
 //
-int fndsector(unsigned char* sector, unsigned char* cart, int gap);
-int appendmdr(unsigned char* mdrname, unsigned char* mdrfile, unsigned char* cart, unsigned char* sector, unsigned char* mdrbl, rrrr len, rrrr start, rrrr param2, unsigned char basic);
-int dcz80(FILE** fp_in, unsigned char* out, int size);
-unsigned long zxsc(unsigned char* fload, unsigned char* store, int filesize, int screen);
-struct loj findmatch(unsigned char* buffer, unsigned char* buffer_ss); // screen layout
-struct loj findmatch2(unsigned char* buffer, unsigned char* buffer_ss, int filesize); // sequential layout
-unsigned long zxlayout(unsigned char* s, unsigned char** c);
+void zxcartblank(struct zxcart* mdr, unsigned char* image, unsigned char* mdrname);
+void zxcartname(const char* name, unsigned char* mdrname);
+int zxcartused(const unsigned char* image);
+int zxcartfree(struct zxcart* mdr);
+int zxchksum(const unsigned char* b, int n);
+int fndsector(struct zxcart* mdr, int gap);
+double zxunpacktime(const unsigned char* comp, unsigned long len, int screen);
+double zxcoast(double busy);
+double zxopstime(const unsigned char* tab);
+int zxpatch(const unsigned char* from, const unsigned char* to, int n, int addr, int port, unsigned char* out, int max);
+double zxpatchtime(const unsigned char* rec, int len);
+int zxsetbasic(const unsigned char* mdrbln, const unsigned char* list, int nlist, unsigned char mainname, unsigned char* out);
+int zxmenubasic(const char** title, int n, unsigned char* out);
+int zxgap(double busy);
+int zxcartread(const unsigned char* image, const unsigned char* mdrfile, unsigned char* out, int max, int* pos, int* len);
+int zxcartload(const unsigned char* image, const unsigned char* loader, unsigned char* ram, unsigned char* skip);
+void zxcartpoke(unsigned char* ram, int port, int addr, unsigned char b);
+int zxverify(const unsigned char* image, const unsigned char* loader, const unsigned char* main, int otek);
+double zxloadfile(int* pos, int nrec, double t);
+int appendmdr(struct zxcart* mdr, unsigned char* mdrfile, unsigned char* code, rrrr len, rrrr start, rrrr param2, unsigned char basic, int gap);
+int dcz80(struct zxin* in, unsigned char* out, int size, int srclen);
+int zxgetc(struct zxin* in);
+int zxread(struct zxin* in, unsigned char* out, int size);
+void zxlog(FILE* log, const char* format, ...);
+double zxclock(void);
+long zxpeakmem(void);
+void zxtokens(const unsigned char* comp, unsigned long len, struct zxtok* tok);
+void zxstatcall(struct zxstats* st, const char* block, double time, int in, unsigned long out, int cached);
+void zxstatsjson(FILE* fp, struct zxstats* st, const char* name, int err, double total, unsigned char* cart);
+unsigned long zxsc(unsigned char* fload, unsigned char* store, int filesize, int screen, struct zxmatch* mt, int parse, int level);
+unsigned long zxsccache(const char* cache, unsigned char* fload, unsigned char* store, int filesize, int screen, struct zxmatch* mt, int parse, int level, int* cached);
+unsigned long long zxfnv(const unsigned char* b, int n, unsigned long long h);
+void zxcachetidy(const char* cache, long max);
+int zxcachedir(const char* cache);
+int zxcachecmp(const void* a, const void* b);
+unsigned long zxscoptimal(unsigned char* fload, unsigned short* length, unsigned short* offset, unsigned char* store, int filesize, int screen, const struct zxcost* k);
+unsigned long zxscgreedy(unsigned char* fload, int filesize, int screen, struct zxmatch* mt, int level);
+int zxmatches(struct zxmatch* mt, unsigned char* buffer, int filesize, int screen, int level);
+struct loj findmatch2(unsigned char* buffer, unsigned char* buffer_ss, int filesize, struct zxhash* hash); // sequential layout
+int zxhashbuild(struct zxhash* hash, unsigned char* buffer, int filesize);
+struct loj findmatchchain(unsigned char* buffer, int ss, int filesize, struct zxchain* chain);
+void zxchainadd(unsigned char* buffer, int ss, int filesize, struct zxchain* chain);
+int zxmatchlen(const unsigned char* a, const unsigned char* b, int max);
+#ifdef ZXSIMD
+int zxmatchlensse2(const unsigned char* a, const unsigned char* b, int max);
+int zxmatchlenavx2(const unsigned char* a, const unsigned char* b, int max);
+#endif
+int (*zxmatchlenpick(void))(const unsigned char* a, const unsigned char* b, int max);
+void zxmatchfree(struct zxmatch* mt);
 int decompressf(unsigned char* comp, int compsize, int mainsize);
+int zxunsc(const unsigned char* comp, int len, unsigned char* out, int max, int screen);
+int zxrunindex(unsigned char* mem, int from, int to, struct zxrun* run);
+int zxrungap(struct zxrun* run, int nrun, int stack, int stacklen, int rank, int* gappos, int* gapchr);
+int zxmainfit(struct zxmainjob* m);
+void zxmainrun(struct zxpool* pool, void* arg);
+void zxpoolstart(struct zxpool* pool, void* job, int size, int njob, int nthread, void (*run)(struct zxpool* pool, void* job));
+void zxpoolfinish(struct zxpool* pool);
+void zxpoollock(struct zxpool* pool);
+void zxpoolunlock(struct zxpool* pool);
+void zxjobrun(struct zxpool* pool, void* arg);
+int zxconvert(const char* fz80, struct zxopt* opt, unsigned char** snap, int* snapmax, unsigned char* cart);
+int zxconvertset(const char** fz80, int n, struct zxopt* opt, unsigned char* cart);
+int zxconvertpack(const char** fz80, int n, struct zxopt* opt, unsigned char* cart);
+int zxsnaptype(const char* fz80);
+int zxsnapsniff(int filesize);
+int zxreadsnap(const char* fz80, unsigned char** snap, int* snapmax, int* filesize);
+void zxbatchadd(struct zxbatch* batch, const char* path, int scan);
+int zxbatchrunall(struct zxbatch* batch);
+void zxbatchrun(struct zxpool* pool, void* arg);
 void error(int errorcode);
 //main
+#ifndef Z80ONMDR_LIB
 int main(int argc, char* argv[]) {
-	// common
 	int i;
-	unsigned char c;
-	rrrr len;
 	//
 	if (argc < 2) {
 		fprintf(stdout, "%s %s (c) Tom Dalby 2021\n", PROGNAME, VERSION_NUM);
-		fprintf(stdout, "  usage: %s game.z80/sna [-o]\n", PROGNAME);
+		fprintf(stdout, "  usage: %s game.z80/sna [-o] [-x|-f] [-1..-9] [-j threads] [-c cache [-m MB]] [-g gap] [-k n] [-v] [--stats]\n", PROGNAME);
 		fprintf(stdout, "  which will convert the z80/sna image to a MicroDrive cartridge called \"game.mdr\"\n");
+		fprintf(stdout, "  or: %s -s game1.z80/sna game2.z80/sna ... to put several of one game on \"game1.mdr\" sharing screens & 128k pages\n", PROGNAME);
+		fprintf(stdout, "  or: %s -p game1.z80/sna game2.z80/sna ... to pack different games with a menu\n", PROGNAME);
+		fprintf(stdout, "  or: %s - [-sna|-z80] [-n name] to convert a snapshot on stdin to a cartridge on stdout\n", PROGNAME);
 		exit(0);
 	}
-	int oldl = 0;
-	if (argc > 2 && strcmp(argv[2], "-o") == 0) {
-		oldl = 1; // use older screen based launcher
-		fprintf(stdout, "[O]");
+	struct zxopt opt = { 0 };
+	struct zxbatch batch = { 0 };
+	int isbatch = strcmp(argv[1], "-b") == 0, isset = strcmp(argv[1], "-s") == 0, ispack = strcmp(argv[1], "-p") == 0, nset = 0;
+	int isstream = strcmp(argv[1], "-") == 0; // snapshot on stdin, cartridge to stdout
+	const char** setfile;
+	if (strcmp(argv[1], "-t") == 0) { // load time of each cartridge
+		unsigned char* cart;
+		double secs;
+		FILE* fp;
+		int err = 0, g;
+		if ((cart = (unsigned char*)malloc(MDRSIZE * sizeof(unsigned char))) == NULL) error(10);
+		for (i = 2; i < argc; i++) {
+			g = 0;
+			if ((fp = fopen(argv[i], "rb")) == NULL) secs = -2.0;
+			else {
+				secs = fread(cart, sizeof(unsigned char), MDRSIZE, fp) == MDRSIZE ? z80onmdrtime(cart) : -1.0;
+				fclose(fp);
+				if (secs == -1.0 && z80onmdrgametime(cart, 1) >= 0.0) { // menu of games, time each one
+					fprintf(stdout, "%s>", argv[i]);
+					for (g = 1; g <= ZXSETMAX && (secs = z80onmdrgametime(cart, g)) >= 0.0; g++) fprintf(stdout, "%s%d:%.1fs", g > 1 ? "," : "", g, secs);
+					fprintf(stdout, "\n");
+					continue;
+				}
+			}
+			if (secs >= 0.0) fprintf(stdout, "%s>%.1fs\n", argv[i], secs);
+			else {
+				fprintf(stdout, "%s[E%02d]\n", argv[i], secs < -1.5 ? 2 : 15);
+				if (err == 0) err = secs < -1.5 ? 2 : 15;
+			}
+		}
+		free(cart);
+		return err;
 	}
-	if (strcmp(&argv[1][strlen(argv[1]) - 4], ".z80") != 0 && strcmp(&argv[1][strlen(argv[1]) - 4], ".Z80") != 0 &&
-		strcmp(&argv[1][strlen(argv[1]) - 4], ".sna") != 0 && strcmp(&argv[1][strlen(argv[1]) - 4], ".SNA") != 0) error(1); // argument isn't .z80/sna or .Z80/SNA
-	//create ouput mdr name from input
-	char* fz80 = argv[1];
-	char fmdr[256]; // limit to 256chars
-	for (i = 0; i < strlen(fz80) - 4 && i < 252; i++) fmdr[i] = fz80[i];
-	fmdr[i] = '\0';
-	strcat(fmdr, ".mdr");
-	//open read/write
-	FILE* fp_in, * fp_out;
-	if ((fp_in = fopen(fz80, "rb")) == NULL) error(2); // cannot open snapshot for read
-	// get filesize
-	fseek(fp_in, 0, SEEK_END); // jump to the end of the file to get the length
-	int filesize = ftell(fp_in); // get the file size
-	rewind(fp_in);
-	// z80 or sna?
-	int snap = 0;
-	if (strcmp(&fz80[strlen(fz80) - 4], ".sna") == 0 || strcmp(&fz80[strlen(fz80) - 4], ".SNA") == 0) snap = 1;
+	if ((setfile = (const char**)malloc(argc * sizeof(char*))) == NULL) error(10);
+	opt.threads = 1;
+	opt.parse = PARSE_GREEDY;
+	opt.log = isstream ? stderr : stdout; // stdout is kept for the cartridge
+	opt.sna = -1; // worked out from the name, or the size on stdin
+	for (i = 2; i < argc; i++) {
+		if (strcmp(argv[i], "-o") == 0) {
+			opt.oldl = 1; // use older screen based launcher
+			fprintf(opt.log, "[O]");
+		}
+		else if (strcmp(argv[i], "-x") == 0) {
+			opt.parse = PARSE_OPTIMAL; // exact optimal parse
+			fprintf(opt.log, "[X]");
+		}
+		else if (strcmp(argv[i], "-f") == 0) {
+			opt.parse = PARSE_TSTATE; // quickest to load & unpack
+			fprintf(opt.log, "[F]");
+		}
+		else if (argv[i][0] == '-' && argv[i][1] >= '1' && argv[i][1] <= '9' && argv[i][2] == '\0') {
+			opt.level = argv[i][1] - '0'; // compression level
+		}
+		else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) {
+			opt.threads = atoi(argv[++i]); // number of threads to compress on
+		}
+		else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+			opt.cache = argv[++i]; // compressed block cache
+			if (zxcachedir(opt.cache)) error(18);
+		}
+		else if (strcmp(argv[i], "-m") == 0 && i + 1 < argc) {
+			opt.cachemax = atol(argv[++i]) << 20; // cache limit in MB
+		}
+		else if (strcmp(argv[i], "-g") == 0 && i + 1 < argc) {
+			opt.gap = atoi(argv[++i]); // fixed gap between files
+		}
+		else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+			opt.search = atoi(argv[++i]); // launcher placements to try
+		}
+		else if (strcmp(argv[i], "-v") == 0) {
+			opt.verify = 1; // read the cartridge back
+		}
+		else if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+			opt.name = argv[++i]; // cartridge name
+		}
+		else if (strcmp(argv[i], "-sna") == 0 || strcmp(argv[i], "-z80") == 0) {
+			opt.sna = argv[i][1] == 's'; // format of the snapshot on stdin
+		}
+		else if (strcmp(argv[i], "--stats") == 0) {
+			opt.stats = stderr; // timings & counters as JSON
+		}
+		else if (isbatch) zxbatchadd(&batch, argv[i], 1); // snapshot or folder to convert
+		else if (isset && nset <= ZXSETMAX) setfile[nset++] = argv[i]; // one more than allowed to give the error
+		else if (ispack) setfile[nset++] = argv[i]; // as many as needed, split over cartridges
+	}
+	if (isbatch) {
+		if (batch.nfile == 0) { // nothing given so read the list from stdin
+			char line[1024];
+			while (fgets(line, sizeof(line), stdin) != NULL) {
+				line[strcspn(line, "\r\n")] = '\0';
+				if (line[0]) zxbatchadd(&batch, line, 0);
+			}
+		}
+		batch.opt = opt;
+		batch.opt.name = NULL; // each is named after its own file
+		batch.opt.verify = 1; // quick enough to check every one
+		free(setfile);
+		return zxbatchrunall(&batch);
+	}
+	// convert into a cartridge in memory
+	unsigned char* snap = NULL, * cart;
+	int snapmax = 0;
+	if ((cart = (unsigned char*)malloc(MDRSIZE * sizeof(unsigned char))) == NULL) error(10); // space for the cartridge
+	if (isset) i = zxconvertset(setfile, nset, &opt, cart);
+	else if (ispack) i = zxconvertpack(setfile, nset, &opt, cart);
+	else {
+#ifdef _WIN32
+		if (isstream) {
+			_setmode(_fileno(stdin), _O_BINARY);
+			_setmode(_fileno(stdout), _O_BINARY);
+		}
+#endif
+		i = zxconvert(argv[1], &opt, &snap, &snapmax, cart);
+	}
+	if (i && isstream) { // keep stdout clean for whatever reads the cartridge
+		fprintf(stderr, "[E%02d]\n", i);
+		exit(i);
+	}
+	if (i) error(i);
+	free(setfile);
+	free(snap);
+	free(cart);
+	// all done
+	return 0;
+}
+#endif
+// convert a snapshot held in memory into a cartridge image, cart must have room for MDRSIZE bytes. Returns 0 if ok
+// otherwise the error code, nothing is kept between calls so it can be run on many threads at once
+int z80onmdr(const unsigned char* snapshot, int filesize, unsigned char* cart, struct zxopt* opt) {
+	// common
+	int i;
+	unsigned char c;
+	rrrr len;
+	int err = 0;
+	int oldl = opt->oldl, parse = opt->parse, threads = opt->threads, snap = opt->sna, gap = opt->gap;
+	struct zxset* set = opt->set; // adding to a cartridge of several snapshots
+	if (threads < 1) threads = 1;
+	if (threads > MAXTHREADS) threads = MAXTHREADS;
+	struct zxin in = { snapshot, filesize, 0 };
+	FILE* log = opt->log;
+	// everything that needs tidying up if the conversion fails part way through
+	unsigned char* main = NULL, * main48k = NULL, * comp = NULL, * comp_p = NULL, * comp_s = NULL, * comp_d = NULL;
+	struct zxrun* run = NULL;
+	struct zxmatch mainmt = { 0 }; // main block matches, kept between goes around the delta loop
+	struct zxmatch scrmt = { 0 }; // screen matches, the default parser reuses them for -x
+	struct zxpool pool;
+	int pooled = 0; // pool needs finishing
+	struct zxstats st;
+	double t, t0 = zxclock();
+	memset(&st, 0, sizeof(st));
+#define zxerror(n) { err = n; goto done; }
+	// extra sectors after a file so the next is there once the Spectrum has been busy for b seconds
+#define zxfilegap(b) (gap ? gap : zxgap(b) - zxgap(0.0))
 	// basic loader
 #define mdrbln_brd 16
+#define mdrbln_usr0 25 // randomize usr 23920
+#define mdrbln_for 41 // for i=0 to 5: load *"m";d;str$ i code
 #define mdrbln_to 51
+#define mdrbln_run 65 // :randomize usr 32179
+#define mdrbln_main 88 // main block file name
+#define mdrbln_usr1 98 // randomize usr 23964
+#define mdrbln_sp 164 // ld sp,ay
 #define mdrbln_pap 135 // paper/ink
 #define mdrbln_fcpy 153 // final copy position
 #define mdrbln_cpyf 156 // copy from, normal 0x5b00
@@ -219,6 +668,26 @@ int main(int argc, char* argv[]) {
 								0xe0,0x07,0x07,0x07,0xfe,0x07,0x20,0x02,0x86,0x23,0xc6,0x02,0x4f,0x88,0x91,0x47,
 								0xf1,0xe5,0xc5,0xe6,0x1f,0x47,0x4e,0x62,0x6b,0x37,0xed,0x42,0xc1,0xed,0xb0,0xe1,
 								0x23,0x18,0xd1,0x3e,0x10,0x01,0xfd,0x7f,0xed,0x79,0xfb,0xc9,0x11 };
+#define unpack_exit 67 // jp pageops when some pages aren't loaded
+	//patches the screen & 128k pages when several snapshots are on one cartridge, loaded last at 32179 with the patch
+	//after it, each the byte count, port value, address & the bytes, 0 to end
+#define patcher_len 38
+	unsigned char patcher[] = {	0x21,0xd9,0x7d,0xf3,0x7e,0xb7,0x28,0x15,0x4f,0x06,0x00,0x23,0x7e,0xc5,0x01,0xfd,	//(0)
+								0x7f,0xed,0x79,0xc1,0x23,0x5e,0x23,0x56,0x23,0xed,0xb0,0x18,0xe7,0x3e,0x10,0x01,	//(16)
+								0xfd,0x7f,0xed,0x79,0xfb,0xc9 };													//(32)
+	//fills or copies the 128k pages that aren't loaded, runs after the unpacker once the last page file is in. Goes
+	//before the unpacker in the 1st page file with its table after it, 3 bytes for each page, the port value, the
+	//port value of the page to copy (0 to fill, 0xff if the copy buffer at 0x8000 already has it) & the fill byte
+#define pageops_last 4 // port value for the last page file
+#define pageops_tab 9 // table address
+#define pageops_len 100
+	unsigned char pageops[] = {	0x3a,0xff,0x7d,0xfe,0x00,0x20,0x54,0xdd,0x21,0x00,0x00,0xdd,0x7e,0x00,0xb7,0x28,	//(0)
+								0x4a,0x01,0xfd,0x7f,0xdd,0x7e,0x01,0xb7,0x28,0x2b,0x3c,0x28,0x0e,0x3d,0xed,0x79,	//(16)
+								0x21,0x00,0xc0,0x11,0x00,0x80,0x01,0x00,0x40,0xed,0xb0,0x01,0xfd,0x7f,0xdd,0x7e,	//(32)
+								0x00,0xed,0x79,0x21,0x00,0x80,0x11,0x00,0xc0,0x01,0x00,0x40,0xed,0xb0,0x11,0x03,	//(48)
+								0x00,0xdd,0x19,0x18,0xc6,0xdd,0x7e,0x00,0xed,0x79,0x21,0x00,0xc0,0x11,0x01,0xc0,	//(64)
+								0x01,0xff,0x3f,0xdd,0x7e,0x02,0x77,0xed,0xb0,0x18,0xe3,0x3e,0x10,0x01,0xfd,0x7f,	//(80)
+								0xed,0x79,0xfb,0xc9 };																//(96)
 	//
 	int otek = 0, stackpos = 0;
 	unsigned char compressed = 0;
@@ -226,56 +695,56 @@ int main(int argc, char* argv[]) {
 	addlen.rrrr = 0; // 0 indicates v1, 23 for v2 otherwise v3
 	//read is sna, compressed=0, addlen.rrrr=0, otek=0
 	if (snap) {
-		if (filesize < 49179) error(14);
+		if (filesize < 49179) zxerror(14);
 		if (filesize >= 131103) otek = 1; // 128k snapshot
 		//	$00  I	Interrupt register
-		mdrbln[mdrbln_i] = fgetc(fp_in);
+		mdrbln[mdrbln_i] = zxgetc(&in);
 		//	$01  HL'
-		mdrbln[mdrbln_hla] = fgetc(fp_in);
-		mdrbln[mdrbln_hla + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_hla] = zxgetc(&in);
+		mdrbln[mdrbln_hla + 1] = zxgetc(&in);
 		//	$03  DE'
-		mdrbln[mdrbln_dea] = fgetc(fp_in);
-		mdrbln[mdrbln_dea + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_dea] = zxgetc(&in);
+		mdrbln[mdrbln_dea + 1] = zxgetc(&in);
 		// check this is a SNA snapshot
 		if (mdrbln[mdrbln_i] == 'M' && mdrbln[mdrbln_hla] == 'V' &&
-			mdrbln[mdrbln_hla + 1] == ' ' && mdrbln[mdrbln_dea] == '-') error(14);
+			mdrbln[mdrbln_hla + 1] == ' ' && mdrbln[mdrbln_dea] == '-') zxerror(14);
 		if (mdrbln[mdrbln_i] == 'Z' && mdrbln[mdrbln_hla] == 'X' &&
-			mdrbln[mdrbln_hla + 1] == '8' && mdrbln[mdrbln_dea] == '2') error(14);
+			mdrbln[mdrbln_hla + 1] == '8' && mdrbln[mdrbln_dea] == '2') zxerror(14);
 		//	$05  BC'
-		mdrbln[mdrbln_bca] = fgetc(fp_in);
-		mdrbln[mdrbln_bca + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_bca] = zxgetc(&in);
+		mdrbln[mdrbln_bca + 1] = zxgetc(&in);
 		//	$07  F'
-		 mdrbln[mdrbln_afa] = fgetc(fp_in);
+		 mdrbln[mdrbln_afa] = zxgetc(&in);
 		//	$08  A'
-		mdrbln[mdrbln_afa + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_afa + 1] = zxgetc(&in);
 		//	$09  HL	
-		launch_scr[launch_scr_hl] = noc_launchstk[noc_launchstk_hl] = fgetc(fp_in);
-		launch_scr[launch_scr_hl + 1] = noc_launchstk[noc_launchstk_hl + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_hl] = noc_launchstk[noc_launchstk_hl] = zxgetc(&in);
+		launch_scr[launch_scr_hl + 1] = noc_launchstk[noc_launchstk_hl + 1] = zxgetc(&in);
 		//	$0B  DE
-		launch_scr[launch_scr_de] = noc_launchigp[noc_launchigp_de] = fgetc(fp_in);
-		launch_scr[launch_scr_de + 1] = noc_launchigp[noc_launchigp_de + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_de] = noc_launchigp[noc_launchigp_de] = zxgetc(&in);
+		launch_scr[launch_scr_de + 1] = noc_launchigp[noc_launchigp_de + 1] = zxgetc(&in);
 		//	$0D  BC
-		launch_scr[launch_scr_bc] = noc_launchstk[noc_launchstk_bc] = fgetc(fp_in);
-		launch_scr[launch_scr_bc + 1] = noc_launchstk[noc_launchstk_bc + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_bc] = noc_launchstk[noc_launchstk_bc] = zxgetc(&in);
+		launch_scr[launch_scr_bc + 1] = noc_launchstk[noc_launchstk_bc + 1] = zxgetc(&in);
 		//	$0F  IY
-		mdrbln[mdrbln_iy] = fgetc(fp_in);
-		mdrbln[mdrbln_iy + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_iy] = zxgetc(&in);
+		mdrbln[mdrbln_iy + 1] = zxgetc(&in);
 		//	$11  IX
-		mdrbln[mdrbln_ix] = fgetc(fp_in);
-		mdrbln[mdrbln_ix + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_ix] = zxgetc(&in);
+		mdrbln[mdrbln_ix + 1] = zxgetc(&in);
 		//	$13  0 for DI otherwise EI
-		c = fgetc(fp_in);
+		c = zxgetc(&in);
 		if (c == 0) launch_scr[launch_scr_ei] = noc_launchstk[noc_launchstk_ei] = 0xf3;	//di
 		else launch_scr[launch_scr_ei] = noc_launchstk[noc_launchstk_ei] = 0xfb;	//ei
 		//	$14  R
-		launch_scr[launch_scr_r] = noc_launchstk[noc_launchstk_r] = fgetc(fp_in);
+		launch_scr[launch_scr_r] = noc_launchstk[noc_launchstk_r] = zxgetc(&in);
 		//	$15  F
-		launch_scr[launch_scr_af] = noc_launchstk[noc_launchstk_af] = fgetc(fp_in);
+		launch_scr[launch_scr_af] = noc_launchstk[noc_launchstk_af] = zxgetc(&in);
 		//	$16  A
-		launch_scr[launch_scr_af + 1] = noc_launchstk[noc_launchstk_af + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_af + 1] = noc_launchstk[noc_launchstk_af + 1] = zxgetc(&in);
 		//	$17  SP
-		stackpos = fgetc(fp_in);
-		stackpos = stackpos + fgetc(fp_in) * 256;
+		stackpos = zxgetc(&in);
+		stackpos = stackpos + zxgetc(&in) * 256;
 		if (!otek)stackpos += 2;
 		if (stackpos == 0) stackpos = 65536;
 		noc_launchstk_pos = stackpos - noc_launchstk_len; // pos of stack code
@@ -283,46 +752,46 @@ int main(int argc, char* argv[]) {
 		launch_scr[launch_scr_sp] = noc_launchigp[noc_launchigp_rd] = len.r[0];
 		launch_scr[launch_scr_sp + 1] = noc_launchigp[noc_launchigp_rd + 1] = len.r[1]; // start of stack within stack
 		// $19  Interrupt mode IM(0, 1 or 2)
-		c = fgetc(fp_in) & 3;
+		c = zxgetc(&in) & 3;
 		if (c == 0) mdrbln[mdrbln_im] = 0x46; //im 0
 		else if (c == 1) mdrbln[mdrbln_im] = 0x56; //im 1
 		else mdrbln[mdrbln_im] = 0x5e; //im 2
 		//	$1A  Border colour
-		c = fgetc(fp_in) & 7;
+		c = zxgetc(&in) & 7;
 		mdrbln[mdrbln_brd] = c + 0x30;
 		mdrbln[mdrbln_pap] = (c << 3) + c;
 	}
 	else {
 		//read in z80 starting with header
 		//	0       1       A register
-		launch_scr[launch_scr_af+1] = noc_launchstk[noc_launchstk_af + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_af+1] = noc_launchstk[noc_launchstk_af + 1] = zxgetc(&in);
 		//	1       1       F register
-		launch_scr[launch_scr_af] = noc_launchstk[noc_launchstk_af] = fgetc(fp_in);
+		launch_scr[launch_scr_af] = noc_launchstk[noc_launchstk_af] = zxgetc(&in);
 		//	2       2       BC register pair(LSB, i.e.C, first)
-		launch_scr[launch_scr_bc] = noc_launchstk[noc_launchstk_bc] = fgetc(fp_in);
-		launch_scr[launch_scr_bc + 1] = noc_launchstk[noc_launchstk_bc + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_bc] = noc_launchstk[noc_launchstk_bc] = zxgetc(&in);
+		launch_scr[launch_scr_bc + 1] = noc_launchstk[noc_launchstk_bc + 1] = zxgetc(&in);
 		//	4       2       HL register pair
-		launch_scr[launch_scr_hl] = noc_launchstk[noc_launchstk_hl] = fgetc(fp_in);
-		launch_scr[launch_scr_hl + 1] = noc_launchstk[noc_launchstk_hl + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_hl] = noc_launchstk[noc_launchstk_hl] = zxgetc(&in);
+		launch_scr[launch_scr_hl + 1] = noc_launchstk[noc_launchstk_hl + 1] = zxgetc(&in);
 		//	6       2       Program counter (if zero then version 2 or 3 snapshot)
-		launch_scr[launch_scr_jp] = noc_launchstk[noc_launchstk_jp] = fgetc(fp_in);
-		launch_scr[launch_scr_jp + 1] = noc_launchstk[noc_launchstk_jp + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_jp] = noc_launchstk[noc_launchstk_jp] = zxgetc(&in);
+		launch_scr[launch_scr_jp + 1] = noc_launchstk[noc_launchstk_jp + 1] = zxgetc(&in);
 		//	8       2       Stack pointer
-		stackpos = fgetc(fp_in);
-		stackpos = stackpos + fgetc(fp_in) * 256;
+		stackpos = zxgetc(&in);
+		stackpos = stackpos + zxgetc(&in) * 256;
 		if (stackpos == 0) stackpos = 65536;
 		noc_launchstk_pos = stackpos - noc_launchstk_len; // pos of stack code
 		len.rrrr = noc_launchstk_pos + noc_launchstk_af;
 		launch_scr[launch_scr_sp] = noc_launchigp[noc_launchigp_rd] = len.r[0];
 		launch_scr[launch_scr_sp + 1] = noc_launchigp[noc_launchigp_rd + 1] = len.r[1]; // start of stack within stack
 		//	10      1       Interrupt register
-		mdrbln[mdrbln_i] = fgetc(fp_in);
+		mdrbln[mdrbln_i] = zxgetc(&in);
 		//	11      1       Refresh register (Bit 7 is not significant!)
-		c = fgetc(fp_in);
+		c = zxgetc(&in);
 		launch_scr[launch_scr_r] = c - 4; // r, reduce by 4 so correct on launch
 		noc_launchstk[noc_launchstk_r] = c - 3; // 3 for 4 stage launcher
 		//	12      1       Bit 0: Bit 7 of r register; Bit 1-3: Border colour; Bit 4=1: SamROM; Bit 5=1:v1 Compressed; Bit 6-7: N/A
-		c = fgetc(fp_in);
+		c = zxgetc(&in);
 		compressed = (c & 32) >> 5;	// 1 compressed, 0 not
 		if (c & 1 || c > 127) {
 			launch_scr[launch_scr_r] = launch_scr[launch_scr_r] | 128;	// r high bit set
@@ -335,61 +804,61 @@ int main(int argc, char* argv[]) {
 		mdrbln[mdrbln_brd] = ((c & 14) >> 1) + 0x30; //border
 		mdrbln[mdrbln_pap] = (((c & 14) >> 1) << 3) + ((c & 14) >> 1); //paper/ink
 		//	13      2       DE register pair
-		launch_scr[launch_scr_de] = noc_launchigp[noc_launchigp_de] = fgetc(fp_in);
-		launch_scr[launch_scr_de + 1] = noc_launchigp[noc_launchigp_de + 1] = fgetc(fp_in);
+		launch_scr[launch_scr_de] = noc_launchigp[noc_launchigp_de] = zxgetc(&in);
+		launch_scr[launch_scr_de + 1] = noc_launchigp[noc_launchigp_de + 1] = zxgetc(&in);
 		//	15      2       BC' register pair
-		mdrbln[mdrbln_bca] = fgetc(fp_in);
-		mdrbln[mdrbln_bca + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_bca] = zxgetc(&in);
+		mdrbln[mdrbln_bca + 1] = zxgetc(&in);
 		//	17      2       DE' register pair
-		mdrbln[mdrbln_dea] = fgetc(fp_in);
-		mdrbln[mdrbln_dea + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_dea] = zxgetc(&in);
+		mdrbln[mdrbln_dea + 1] = zxgetc(&in);
 		//	19      2       HL' register pair
-		mdrbln[mdrbln_hla] = fgetc(fp_in);
-		mdrbln[mdrbln_hla + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_hla] = zxgetc(&in);
+		mdrbln[mdrbln_hla + 1] = zxgetc(&in);
 		//	21      1       A' register
-		mdrbln[mdrbln_afa + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_afa + 1] = zxgetc(&in);
 		//	22      1       F' register
-		mdrbln[mdrbln_afa] = fgetc(fp_in);
+		mdrbln[mdrbln_afa] = zxgetc(&in);
 		//	23      2       IY register (Again LSB first)
-		mdrbln[mdrbln_iy] = fgetc(fp_in);
-		mdrbln[mdrbln_iy + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_iy] = zxgetc(&in);
+		mdrbln[mdrbln_iy + 1] = zxgetc(&in);
 		//	25      2       IX register
-		mdrbln[mdrbln_ix] = fgetc(fp_in);
-		mdrbln[mdrbln_ix + 1] = fgetc(fp_in);
+		mdrbln[mdrbln_ix] = zxgetc(&in);
+		mdrbln[mdrbln_ix + 1] = zxgetc(&in);
 		//	27      1       Interrupt flipflop, 0 = DI, otherwise EI
-		c = fgetc(fp_in);
+		c = zxgetc(&in);
 		if (c == 0) launch_scr[launch_scr_ei] = noc_launchstk[noc_launchstk_ei] = 0xf3;	//di
 		else launch_scr[launch_scr_ei] = noc_launchstk[noc_launchstk_ei] = 0xfb;	//ei
 		//	28      1       IFF2 [IGNORED]
-		c = fgetc(fp_in);
+		c = zxgetc(&in);
 		//	29      1       Bit 0-1: IM(0, 1 or 2); Bit 2-7: N/A
-		c = fgetc(fp_in) & 3;
+		c = zxgetc(&in) & 3;
 		if (c == 0) mdrbln[mdrbln_im] = 0x46; //im 0
 		else if (c == 1) mdrbln[mdrbln_im] = 0x56; //im 1
 		else mdrbln[mdrbln_im] = 0x5e; //im 2
 		// version 2 & 3 only
 		if (launch_scr[launch_scr_jp] == 0 && launch_scr[launch_scr_jp + 1] == 0) {
 			//  30      2       Length of additional header block
-			addlen.r[0] = fgetc(fp_in);
-			addlen.r[1] = fgetc(fp_in);
+			addlen.r[0] = zxgetc(&in);
+			addlen.r[1] = zxgetc(&in);
 			//  32      2       Program counter
-			launch_scr[launch_scr_jp] = noc_launchstk[noc_launchstk_jp] = fgetc(fp_in);
-			launch_scr[launch_scr_jp + 1] = noc_launchstk[noc_launchstk_jp + 1] = fgetc(fp_in);
+			launch_scr[launch_scr_jp] = noc_launchstk[noc_launchstk_jp] = zxgetc(&in);
+			launch_scr[launch_scr_jp + 1] = noc_launchstk[noc_launchstk_jp + 1] = zxgetc(&in);
 			//	34      1       Hardware mode standard 0-6 (2 is SamRAM), 7 +3, 8 +3 & 10 not supported, 11 Didatik, 12 +2, 13 +2A
-			c = fgetc(fp_in);
-			if (c == 2 || c == 10 || c == 11 || c > 13) error(4);
+			c = zxgetc(&in);
+			if (c == 2 || c == 10 || c == 11 || c > 13) zxerror(4);
 			if (addlen.rrrr == 23 && c > 2) otek = 1; // v2 & c>2 then 128k, if v3 then c>3 is 128k
 			else if (c > 3) otek = 1;
 			//	35      1       If in 128 mode, contains last OUT to 0x7ffd
-			c = fgetc(fp_in);
+			c = zxgetc(&in);
 			if (otek) launch_scr[launch_scr_out] = noc_launchstk[noc_launchstk_out] = c;
 			//	36      1       Contains 0xff if Interface I rom paged [SKIPPED]
 			//	37      1       Hardware Modify Byte [SKIPPED]
-			fseek(fp_in, 2, SEEK_CUR);
+			in.pos += 2;
 			//	38      1       Last OUT to port 0xfffd (soundchip register number)
 			//	39      16      Contents of the sound chip registers
-			mdrbln[mdrbln_fffd] = fgetc(fp_in);	// last out to $fffd (38)
-			for (i = 0; i < 16; i++) mdrbln[mdrbln_ay + i] = fgetc(fp_in); // ay registers (39-54) 
+			mdrbln[mdrbln_fffd] = zxgetc(&in);	// last out to $fffd (38)
+			for (i = 0; i < 16; i++) mdrbln[mdrbln_ay + i] = zxgetc(&in); // ay registers (39-54) 
 			// following is only in v3 snapshots
 			//	55      2       Low T state counter [SKIPPED]
 			//	57      1       Hi T state counter [SKIPPED]
@@ -403,20 +872,21 @@ int main(int argc, char* argv[]) {
 			//	83      1       MGT type : 0 = Disciple + Epson, 1 = Disciple + HP, 16 = Plus D [SKIPPED]
 			//	84      1       Disciple inhibit button status : 0 = out, 0ff = in [SKIPPED]
 			//	85      1       Disciple inhibit flag : 0 = rom pageable, 0ff = not [SKIPPED]
-			if (addlen.rrrr > 23) fseek(fp_in, 31, SEEK_CUR);
+			if (addlen.rrrr > 23) in.pos += 31;
 			// only if version 3 & 55 additional length
 			//	86      1       Last OUT to port 0x1ffd, ignored for Microdrive as only applicable on +3/+2A machines [SKIPPED]
-			if (addlen.rrrr == 55) 	if ((fgetc(fp_in) & 1) == 1) error(5); //special page mode so exit as not compatible with earlier 128k machines
+			if (addlen.rrrr == 55) 	if ((zxgetc(&in) & 1) == 1) zxerror(5); //special page mode so exit as not compatible with earlier 128k machines
 		}
 	}
 	//space for decompression of z80
 	//8 * 16384 = 131072bytes
 	//     0- 49152 - Pages 5,2 & 0 (main memory)
 	// *128k only - 49152-65536: Page 1; 65536-81920: Page 3; 81920-98304: Page 4; 98304-114688: Page 6; 114688-131072: Page 7
-	unsigned char* main;
+	st.header = zxclock() - t0;
+	t = zxclock();
 	int fullsize = 49152;
 	if (otek) fullsize = 131072;
-	if ((main = (unsigned char*)malloc(fullsize * sizeof(unsigned char))) == NULL) error(6); // cannot create space for decompressed z80 
+	if ((main = (unsigned char*)malloc(fullsize * sizeof(unsigned char))) == NULL) zxerror(6); // cannot create space for decompressed z80 
 	// which version of z80?
 	len.rrrr = 0;
 	int bank[11], bankend;
@@ -440,22 +910,22 @@ int main(int argc, char* argv[]) {
 		bankend = 3;
 	}
 	if (addlen.rrrr == 0) { // version 1 snapshot & 48k only
-		if (snap) fprintf(stdout, "SNA-");
-		else fprintf(stdout, "v1-");
+		if (snap) zxlog(log, "SNA-");
+		else zxlog(log, "v1-");
 		if (!compressed) {
-			if (fread(main, sizeof(unsigned char), 49152, fp_in) != 49152) error(7);
+			if (zxread(&in, main, 49152) != 49152) zxerror(7);
 		}
 		else {
-			if (dcz80(&fp_in, &main[0], 49152) != 49152) error(7);
+			if (dcz80(&in, &main[0], 49152, in.size - in.pos) != 49152) zxerror(7);
 		}
 		if (otek) {
 			// PC
-			launch_scr[launch_scr_jp] = noc_launchstk[noc_launchstk_jp] = fgetc(fp_in);
-			launch_scr[launch_scr_jp + 1] = noc_launchstk[noc_launchstk_jp + 1] = fgetc(fp_in);
+			launch_scr[launch_scr_jp] = noc_launchstk[noc_launchstk_jp] = zxgetc(&in);
+			launch_scr[launch_scr_jp + 1] = noc_launchstk[noc_launchstk_jp + 1] = zxgetc(&in);
 			// last out to 0x7ffd
-			launch_scr[launch_scr_out] = noc_launchstk[noc_launchstk_out] = fgetc(fp_in);
+			launch_scr[launch_scr_out] = noc_launchstk[noc_launchstk_out] = zxgetc(&in);
 			// TD-DOS
-			if (fgetc(fp_in) != 0) error(14);
+			if (zxgetc(&in) != 0) zxerror(14);
 			int pagelayout[7];
 			for (i = 0; i < 7; i++) pagelayout[i] = 99;
 			pagelayout[0] = launch_scr[launch_scr_out] & 7;
@@ -529,15 +999,15 @@ int main(int argc, char* argv[]) {
 			if (pagelayout[0] != 32768) for (i = 0; i < 16384; i++) main[pagelayout[0] + i] = main[32768 + i]; //copy 0->?
 			for (i = 1; i < 7; i++) {
 				if (pagelayout[i] != 99) {
-					if (fread(&main[pagelayout[i]], sizeof(unsigned char), 16384, fp_in) != 16384) error(7);
+					if (zxread(&in, &main[pagelayout[i]], 16384) != 16384) zxerror(7);
 				}
 			}
 		}
 	}
 	// version 2 & 3
 	else {
-		if (addlen.rrrr == 23) fprintf(stdout, "V2-");
-		else fprintf(stdout, "V3-");
+		if (addlen.rrrr == 23) zxlog(log, "V2-");
+		else zxlog(log, "V3-");
 		//		Byte    Length  Description
 		//		-------------------------- -
 		//		0       2       Length of compressed data(without this 3 - byte header)
@@ -549,29 +1019,35 @@ int main(int argc, char* argv[]) {
 		// for 128k snapshots the order is:
 		//		0 ROM, 1 ROM, 3 Page 0....10 page 7, 11 MF ROM.
 		// all pages are saved and there is no end marker
+		int loaded = 0; // bit for each bank read in
 		do {
-			len.r[0] = fgetc(fp_in);
-			len.r[1] = fgetc(fp_in);
-			c = fgetc(fp_in);
-			if (bank[c] != 99) {
+			if (in.size - in.pos < 3) zxerror(7); // ends before the block header
+			len.r[0] = zxgetc(&in);
+			len.r[1] = zxgetc(&in);
+			c = zxgetc(&in);
+			if (c < 11 && bank[c] != 99) {
 				if (len.rrrr == 65535) {
-					if (fread(&main[bank[c]], sizeof(unsigned char), 16384, fp_in) != 16384) error(7);
+					if (zxread(&in, &main[bank[c]], 16384) != 16384) zxerror(7);
 				}
-				else if (dcz80(&fp_in, &main[bank[c]], 16384) != 16384) error(7);
+				else if (dcz80(&in, &main[bank[c]], 16384, len.rrrr) != 16384) zxerror(7);
+				loaded |= 1 << c;
 			}
+			else in.pos += len.rrrr == 65535 ? 16384 : len.rrrr; // skip pages that aren't needed
+			if (in.pos > in.size) zxerror(7);
 			bankend--;
 		} while (bankend);
+		for (i = 0; i < 11; i++) if (bank[i] != 99 && !(loaded & 1 << i)) zxerror(7); // a page is missing
 	}
-	fclose(fp_in);
 	//
 	if (snap && !otek) {
+		if (stackpos < 16384 + 2 || stackpos > 65536) zxerror(14); // pc would be popped from rom or past the top
 		launch_scr[launch_scr_jp] = noc_launchstk[noc_launchstk_jp] = main[stackpos - 16384 - 2];
 		launch_scr[launch_scr_jp + 1] = noc_launchstk[noc_launchstk_jp + 1] = main[stackpos - 16384 - 1];
 	}
 	//
 	if (stackpos < 23296) { // stack in screen?
 		i = launch_scr[launch_scr_jp + 1] * 256 + launch_scr[launch_scr_jp] - 16384;
-		if (main[i] == 0x31) { // ld sp,
+		if (i >= 0 && i < 49152 - 2 && main[i] == 0x31) { // ld sp, (pc could be in rom)
 			// set-up stack
 			stackpos = main[i + 2] * 256 + main[i + 1];
 			if (stackpos == 0) stackpos = 65536;
@@ -579,56 +1055,23 @@ int main(int argc, char* argv[]) {
 			len.rrrr = noc_launchstk_pos + noc_launchstk_af;
 			noc_launchigp[noc_launchigp_rd] = len.r[0];
 			noc_launchigp[noc_launchigp_rd + 1] = len.r[1]; // start of stack within stack
-			fprintf(stdout, "{S:%d}", stackpos);
+			zxlog(log, "{S:%d}", stackpos);
 		}
 	}
-	else if ((launch_scr[launch_scr_out] & 7) > 0 && stackpos > 49152 && otek) error(7); // stack in paged memory won't work
+	else if ((launch_scr[launch_scr_out] & 7) > 0 && stackpos > 49152 && otek) zxerror(7); // stack in paged memory won't work
+	if (stackpos - noc_launchstk_len - noc_launchstk_af < 16384) zxerror(7); // stack code, even shifted down, would go in rom
+	st.decomp = zxclock() - t;
 	//microdrive settings
-	unsigned char sector = 0xfe; // max size 254 sectors
-	int mdrsize = 137923; // sector * 543 + 1;
+	struct zxcart mdr;
 	unsigned char mdrname[] = "          ";
-	i = 0;
-	int mp = 0;
-	do {
-		if ((fz80[i] >= 48 && fz80[i] < 58) || (fz80[i] >= 65 && fz80[i] < 91) || (fz80[i] >= 97 && fz80[i] < 123)) mdrname[mp++] = fz80[i];
-		i++;
-	} while (i < strlen(fz80) - 4 && mp < 10);
+	zxcartname(opt->name, mdrname);
 	// create a blank cartridge in memory
-	unsigned char* cart;
-	if ((cart = (unsigned char*)malloc(mdrsize * sizeof(unsigned char))) == NULL) error(10); // space for the cartridge
-	rrrr chksum;
-	int j = 0;
-	do {
-		// header
-		chksum.rrrr = sector + 1;
-		cart[j++] = 0x01;
-		cart[j++] = sector--;
-		cart[j++] = 0x00;
-		cart[j++] = 0x00;
-		for (i = 0; i < 10; i++) {
-			cart[j++] = mdrname[i];
-			chksum.rrrr += mdrname[i];
-			chksum.rrrr = chksum.rrrr % 255;
-		}
-		cart[j++] = chksum.r[0];
-		// blank 2nd header
-		chksum.rrrr = 0;
-		for (i = 0; i < 14; i++) {
-			cart[j++] = 0x00;
-			chksum.rrrr += 0x00;
-			chksum.rrrr = chksum.rrrr % 255;
-		}
-		cart[j++] = chksum.r[0];
-		chksum.rrrr = 0;
-		for (i = 0; i < 512; i++) {
-			cart[j++] = 0x00;
-			chksum.rrrr += 0x00;
-			chksum.rrrr = chksum.rrrr % 255;
-		}
-		cart[j++] = chksum.r[0];
-	} while (sector > 0x00);
-	cart[j] = 0x00; // cartridge not write protected
-	sector = 0xfe;
+	t = zxclock();
+	if (set && set->n == ZXSETMAX) zxerror(16);
+	if (set && set->mdr.image) mdr = set->mdr; // carry on after the last snapshot or the menu
+	else zxcartblank(&mdr, cart, mdrname);
+	int j, k;
+	st.assembly += zxclock() - t;
 	// add files to blank cartridge in interleaved format which leaves a sector between each sector written, which allows 
 	// the drive to pick up the next sector quicker and as a result loads the game faster. After filling the drive it
 	// loops back to the first unused sector
@@ -636,14 +1079,9 @@ int main(int argc, char* argv[]) {
 	rrrr start;
 	rrrr param;
 	rrrr cmsize;
-	unsigned char* comp;
 	// main
-	unsigned char* main48k;
 	int delta = 3;
-	int vgap = 0;
-	int vgaps, vgapb;
-	int maxgap, maxpos, maxchr, stshift = 0;
-	int dgap = 0;
+	int stshift = 0;
 	int startpos = 6966; // 0x5b36 onwards so have to save at least 1562bytes
 	int mainsize = 42186; 
 	if (oldl) {
@@ -651,109 +1089,192 @@ int main(int argc, char* argv[]) {
 		mainsize += noc_launchprt_len;
 	}
 	int maxsize = 40624; // 0x6150 onwards
-	if ((main48k = (unsigned char*)malloc(49152 * sizeof(unsigned char))) == NULL) error(6); // cannot create space for copy of main memory
-	if ((comp = (unsigned char*)malloc((mainsize + 10240) * sizeof(unsigned char))) == NULL) error(8);
-	do {
-		for (i = 0; i < 49152; i++) main48k[i] = main[i]; // create copy of 1st 48k for manipulation
-		// new byte series scan
-		if (oldl == 0) {
-			noc_launchigp_pos = 0;
-			// find maximum gap
-			maxgap = maxpos = maxchr = 0;
-			for (vgap = 0x00; vgap <= 0xff; vgap++) { // cycle through all bytes
-				for (i = 0, j = 0; i < mainsize; i++) { // also include rest of printer buffer
-					if (main48k[i + 6912 + noc_launchprt_len] == vgap) {
-						j++;
-						if (j > maxgap && ((i + 6912 + noc_launchprt_len - j) > stackpos - 16384 || // start of gap > stack then ok
-							i + 6912 + noc_launchprt_len < stackpos - 16384 - noc_launchstk_len)) { // end of gap < stack - 32 then ok
-							maxgap = j;
-							maxpos = i + 1;
-							maxchr = vgap;
-						}
-					}
-					else {
-						j = 0;
-					}
-				}
-			}
-			if (maxgap > (noc_launchigp_len + delta - 3)) {
-				noc_launchigp_pos = maxpos + 6912 + noc_launchprt_len - maxgap; // start of in gap 
-			}
-			else {	// cannot find large enough gap so use screen attr
-				noc_launchigp_pos = 6912 - (noc_launchigp_len + delta - 3);
-				vgaps = 0x00;
-				vgapb = 0;
-				for (maxchr = 0x00; maxchr <= 0xff; maxchr++) {	//find most common attr
-					for (i = noc_launchigp_pos, j = 0; i < 6912; i++) {
-						if (main48k[i] == maxchr) j++;
-					}
-					if (j >= vgapb) {
-						vgapb = j;
-						vgaps = maxchr;
-					}
+	if ((main48k = (unsigned char*)malloc(49152 * sizeof(unsigned char))) == NULL) zxerror(6); // cannot create space for copy of main memory
+	if ((comp = (unsigned char*)malloc((mainsize + 10240) * sizeof(unsigned char))) == NULL) zxerror(8);
+	// 128k pages don't depend on the launcher so compress them on the other threads while the main block is sorted out.
+	// A page that is one byte all the way through or the same as an earlier page isn't loaded, pageops fills or copies
+	// it instead so there is nothing to compress & one less file to find on the cartridge
+	int pagenum[5] = { 1, 3, 4, 6, 7 }, pagecopy[5], pagefile[5], npage = 0, ntab = 0;
+	unsigned char pagetab[16]; // pageops table
+#define comp_p_pre (pageops_len + 16 + unpack_len) // room for pageops, its table & the unpacker or page number
+#define comp_p_len (16384 + 512 + comp_p_pre)
+	struct zxjob pagejob[5];
+	if (otek) {
+		if ((comp_p = (unsigned char*)malloc(5 * comp_p_len * sizeof(unsigned char))) == NULL) zxerror(8);
+		for (j = 0; j < 5; j++) {
+			unsigned char* page = &main[bank[pagenum[j] + 3]];
+			pagecopy[j] = -1; // load it
+			if (set && !set->games) continue; // pages are shared between the snapshots instead
+			for (i = 1; i < 16384 && page[i] == page[0]; i++);
+			if (i == 16384) pagecopy[j] = 8; // fill
+			else for (k = 0; k < j; k++) {
+				if (pagecopy[k] == -1 && memcmp(page, &main[bank[pagenum[k] + 3]], 16384) == 0) {
+					pagecopy[j] = pagenum[k]; // copy
+					break;
 				}
-				maxchr = vgaps;
-			}
-			// is pc in the way?
-			if (noc_launchstk_pos <= (noc_launchstk[noc_launchstk_jp + 1] * 256 + noc_launchstk[noc_launchstk_jp]) &&
-					noc_launchstk_pos + noc_launchstk_len > (noc_launchstk[noc_launchstk_jp + 1] * 256 + noc_launchstk[noc_launchstk_jp])) {
-				stshift = stackpos - (noc_launchstk[noc_launchstk_jp + 1] * 256 + noc_launchstk[noc_launchstk_jp]); // stack - pc
-				if (stshift <= 2) error(13);
-				stshift = noc_launchstk_af; // shift equivalent of 32bytes below where is was (4bytes still remain under the stack)
 			}
-			start.rrrr = noc_launchigp_pos + 16384;
-			noc_launchprt[noc_launchprt_jp] = start.r[0];
-			noc_launchprt[noc_launchprt_jp + 1] = start.r[1]; // jump into gap
-			start.rrrr = noc_launchigp_pos + noc_launchigp_begin + 16384;
-			noc_launchigp[noc_launchigp_bdata] = start.r[0];
-			noc_launchigp[noc_launchigp_bdata + 1] = start.r[1]; // bdata start
-			noc_launchigp[noc_launchigp_lcs] = delta;
-			if (noc_launchigp_len + delta - 3 == 256) {
-				noc_launchigp[noc_launchigp_clr] = 0x00;
-			}
-			else {
-				noc_launchigp[noc_launchigp_clr] = noc_launchigp_len + delta - 3; // size of ingap clear
-			}
-			noc_launchigp[noc_launchigp_chr] = maxchr; // set the erase char in stack code
-			start.rrrr = noc_launchstk_pos - stshift;
-			noc_launchigp[noc_launchigp_jp] = start.r[0];
-			noc_launchigp[noc_launchigp_jp + 1] = start.r[1]; // jump to stack code - adjust - shift
-			// copy stack routine under stack, split version if shift
-			if (stshift) {
-				for (i = 0; i < noc_launchstk_len - 2; i++) main48k[noc_launchstk_pos - 16384 + i - stshift] = noc_launchstk[i];
-				//final 2bytes just below new code
-				for (i = 0; i < 2; i++) main48k[stackpos - 16384 + i - 2] = noc_launchstk[noc_launchstk_len - 2 + i];
+		}
+		for (j = 0; j < 5 && pagecopy[j] != -1; j++);
+		if (j == 5) pagecopy[0] = -1; // has to be at least one page file to run pageops
+		for (j = 0; j < 5; j++) {
+			if (pagecopy[j] == -1) {
+				pagejob[npage].fload = &main[bank[pagenum[j] + 3]];
+				pagejob[npage].store = &comp_p[npage * comp_p_len + comp_p_pre];
+				pagejob[npage].filesize = 16384;
+				pagejob[npage].screen = 0;
+				pagejob[npage].parse = parse;
+				pagejob[npage].level = opt->level;
+				pagejob[npage].cache = opt->cache;
+				pagefile[npage++] = pagenum[j];
 			}
-			else {
-				for (i = 0; i < noc_launchstk_len; i++) main48k[noc_launchstk_pos - 16384 + i] = noc_launchstk[i]; // standard copy
+			else if (pagecopy[j] == 8) {
+				pagetab[ntab * 3] = 0x10 + pagenum[j];
+				pagetab[ntab * 3 + 1] = 0x00;
+				pagetab[ntab * 3 + 2] = main[bank[pagenum[j] + 3]];
+				ntab++;
 			}
-			// if ingap not in screen attr, this is done after so as to not effect the screen compression
-			if (noc_launchigp_pos >= 6912) {
-				// copy prtbuf to code
-				for (i = 0; i < noc_launchprt_len; i++) main48k[noc_launchigp_pos + noc_launchigp_begin + delta + i] = main48k[6912 + i];
-				// copy delta to code
-				for (i = 0; i < delta; i++) main48k[noc_launchigp_pos + noc_launchigp_begin + i] = main48k[49152 - delta + i];
-				// copy in compression routine into main
-				for (i = 0; i < noc_launchigp_begin; i++) main48k[noc_launchigp_pos + i] = noc_launchigp[i];
+		}
+		for (k = 0; k < 5; k++) {
+			for (j = k + 1, c = 0x10 + pagenum[k]; j < 5; j++) {
+				if (pagecopy[j] == pagenum[k]) {
+					pagetab[ntab * 3] = 0x10 + pagenum[j];
+					pagetab[ntab * 3 + 1] = c; // the 1st copy fills the buffer
+					pagetab[ntab * 3 + 2] = 0x00;
+					c = 0xff;
+					ntab++;
+				}
 			}
 		}
-		cmsize.rrrr = zxsc(&main48k[startpos], &comp[8704], mainsize - delta, 0); // upto the full size - delta
-		dgap = decompressf(&comp[8704], cmsize.rrrr, mainsize);
-		delta += dgap;
-		if (delta > B_GAP) error(9);
-	} while (dgap > 0);
-	// sort out adder
-	int adder = 0;
-	if (oldl) {
-		adder = launch_scr_len + delta - 3; // add launcher + delta
+		pagetab[ntab * 3] = 0x00;
 	}
-	else {
-		adder = noc_launchprt_len; // just add prtbuf launcher
-		if (noc_launchigp_pos < 6912) adder += noc_launchprt_len + delta + noc_launchigp_begin; // if ingap in screen 
+	zxpoolstart(&pool, pagejob, sizeof(struct zxjob), npage, threads - 1, zxjobrun);
+	pooled = 1;
+	// index the runs once, the gap search looks at memory before the launcher is added so this is the same every time
+	int nrun = 0;
+	double td;
+	if (oldl == 0) {
+		t = zxclock();
+		if ((run = (struct zxrun*)malloc(mainsize * sizeof(struct zxrun))) == NULL) zxerror(8);
+		nrun = zxrunindex(main, 6912 + noc_launchprt_len, 6912 + noc_launchprt_len + mainsize, run); // also include rest of printer buffer
+		st.gap += zxclock() - t;
 	}
+	td = zxclock();
+	struct zxmainjob mainjob;
+	memset(&mainjob, 0, sizeof(mainjob));
+	mainjob.main = main;
+	mainjob.run = run;
+	mainjob.nrun = nrun;
+	mainjob.rank = 0;
+	mainjob.delta = 3;
+	mainjob.oldl = oldl;
+	mainjob.stackpos = stackpos;
+	mainjob.stkpos = noc_launchstk_pos;
+	mainjob.startpos = startpos;
+	mainjob.mainsize = mainsize;
+	mainjob.parse = parse;
+	mainjob.level = opt->level;
+	mainjob.stk = noc_launchstk;
+	memcpy(mainjob.igp, noc_launchigp, noc_launchigp_begin);
+	memcpy(mainjob.prt, noc_launchprt, noc_launchprt_len);
+	mainjob.cache = opt->cache;
+	mainjob.main48k = main48k;
+	mainjob.comp = comp;
+	mainjob.mt = &mainmt;
+	mainjob.st = &st;
+	if (opt->search > 1) {
+		// the usual go is job 0 so it wins a tie, the rest try the next gaps down then bigger starting deltas with
+		// their own buffers. The attributes are only used when the longest gap is too small, as the clear there
+		// loses the bytes under the gap code
+		int nsearch = opt->search > ZXSEARCHMAX ? ZXSEARCHMAX : opt->search, best = 0;
+		struct zxmainjob* job;
+		struct zxstats* jobst;
+		struct zxpool spool;
+		if ((job = (struct zxmainjob*)calloc(nsearch, sizeof(struct zxmainjob))) == NULL) zxerror(8);
+		if ((jobst = (struct zxstats*)calloc(nsearch, sizeof(struct zxstats))) == NULL) {
+			free(job);
+			zxerror(8);
+		}
+		for (j = 0; j < nsearch; j++) {
+			job[j] = mainjob;
+			job[j].st = &jobst[j]; // only the winner's calls & delta loops go in st
+			if (j == 0) continue;
+			job[j].rank = oldl ? 0 : j < 4 ? j : 0;
+			job[j].delta = oldl ? 3 + j : j < 4 ? 3 : j;
+			job[j].main48k = (unsigned char*)malloc(49152 * sizeof(unsigned char));
+			job[j].comp = (unsigned char*)malloc((mainsize + 10240) * sizeof(unsigned char));
+			job[j].mt = (struct zxmatch*)calloc(1, sizeof(struct zxmatch));
+			if (job[j].main48k == NULL || job[j].comp == NULL || job[j].mt == NULL) job[j].err = 8;
+		}
+		zxpoolstart(&spool, job, sizeof(struct zxmainjob), nsearch, threads - 1, zxmainrun);
+		zxpoolfinish(&spool);
+		for (j = 0; j < nsearch; j++) {
+			if (job[j].err == 0 && job[j].cmsize + job[j].adder < job[best].cmsize + job[best].adder) best = j;
+			st.gap += jobst[j].gap;
+		}
+		if (best) { // take the winner's launcher, memory & matches in place of the usual go's
+			memcpy(main48k, job[best].main48k, 49152);
+			memcpy(&comp[8704], &job[best].comp[8704], job[best].cmsize);
+			zxmatchfree(&mainmt);
+			mainmt = *job[best].mt;
+			memset(job[best].mt, 0, sizeof(struct zxmatch));
+		}
+		for (i = 0; i < jobst[best].ncall; i++) zxstatcall(&st, jobst[best].call[i].block, jobst[best].call[i].time, jobst[best].call[i].in, jobst[best].call[i].out, jobst[best].call[i].cached);
+		st.ndelta += jobst[best].ndelta;
+		mainjob = job[best];
+		mainjob.main48k = main48k;
+		mainjob.comp = comp;
+		mainjob.mt = &mainmt;
+		mainjob.st = &st;
+		for (j = 1; j < nsearch; j++) {
+			if (job[j].mt) zxmatchfree(job[j].mt);
+			free(job[j].mt);
+			free(job[j].comp);
+			free(job[j].main48k);
+		}
+		free(jobst);
+		free(job);
+	}
+	else zxmainfit(&mainjob);
+	if (mainjob.err) zxerror(mainjob.err);
+	memcpy(noc_launchigp, mainjob.igp, noc_launchigp_begin);
+	memcpy(noc_launchprt, mainjob.prt, noc_launchprt_len);
+	noc_launchigp_pos = mainjob.igppos;
+	stshift = mainjob.stshift;
+	delta = mainjob.delta;
+	cmsize.rrrr = mainjob.cmsize;
+	st.delta = zxclock() - td;
+	zxtokens(&comp[8704], cmsize.rrrr, &st.tok);
+	unsigned long gain = 0; // bytes saved by the optimal parser
+	if (parse == PARSE_OPTIMAL) {
+		t = zxclock();
+		if ((len.rrrr = zxscgreedy(&main48k[startpos], mainsize - delta, 0, &mainmt, opt->level)) == 0) zxerror(8);
+		zxstatcall(&st, "main-dflt", zxclock() - t, mainsize - delta, len.rrrr, 0);
+		gain += len.rrrr - cmsize.rrrr;
+	}
+	int adder = mainjob.adder;
 	maxsize -= delta;
 	cmsize.rrrr += adder;
-	if (delta > B_GAP || cmsize.rrrr > maxsize) error(9); // too big to fit in Spectrum memory
+	if (delta > B_GAP || cmsize.rrrr > maxsize) zxerror(9); // too big to fit in Spectrum memory
+	// screen **v1.3 moved here in case stack within screen
+	rrrr len_s;
+	if ((comp_s = (unsigned char*)malloc((6912 + 216 + 109) * sizeof(unsigned char))) == NULL) zxerror(8);
+	t = zxclock();
+	len_s.rrrr = zxsccache(opt->cache, &main48k[0], &comp_s[scrload_len], 6912, 1, &scrmt, parse, opt->level, &i);
+	zxstatcall(&st, "screen", zxclock() - t, 6912, len_s.rrrr, i);
+	if (len_s.rrrr == 0) zxerror(8);
+	zxtokens(&comp_s[scrload_len], len_s.rrrr, &st.tok);
+	if (parse == PARSE_OPTIMAL) {
+		t = zxclock();
+		if ((len.rrrr = zxscgreedy(&main48k[0], 6912, 1, &scrmt, opt->level)) == 0) zxerror(8);
+		zxstatcall(&st, "screen-dflt", zxclock() - t, 6912, len.rrrr, 0);
+		gain += len.rrrr - len_s.rrrr;
+	}
+	len_s.rrrr += scrload_len;
+	for (i = 0; i < scrload_len; i++) comp_s[i] = scrload[i]; // add m/c
+	t = zxclock();
+	zxpoolfinish(&pool); // pages are written in order once they are all done so the cartridge is the same
+	pooled = 0;
+	st.pagewait = zxclock() - t;
 	// BASIC
 	unsigned char mdrfname[] = "run       ";
 	// sort out compression start
@@ -792,76 +1313,156 @@ int main(int argc, char* argv[]) {
 	start.rrrr = 23813;
 	param.rrrr = 0;
 	if (otek) {
-		fprintf(stdout, "128k>");
+		mdrbln[mdrbln_to] = 0x30 + npage; // screen & page files
+		zxlog(log, "128k>");
 	}
 	else {
 		mdrbln[mdrbln_to] = 0x30; // for i=0 to 0 as only one thing to load
-		fprintf(stdout, "48k>");
+		zxlog(log, "48k>");
 	}
 	len.rrrr = mdrbln_len;
-	i = appendmdr(mdrname, mdrfname, cart, &sector, mdrbln, len, start, param, 0x00);
-	fprintf(stdout, "R(%lu)+", len.rrrr);
-	mdrfname[1] = mdrfname[2] = ' ';
-	// screen **v1.3 moved here in case stack within screen
-	unsigned char* comp_s;
-	rrrr len_s;
-	if ((comp_s = (unsigned char*)malloc((6912 + 216 + 109) * sizeof(unsigned char))) == NULL) error(8);
-	len_s.rrrr = zxsc(&main48k[0], &comp_s[scrload_len], 6912, 1);
-	len_s.rrrr += scrload_len;
-	for (i = 0; i < scrload_len; i++) comp_s[i] = scrload[i]; // add m/c
+	// several snapshots on one cartridge, the screen & each page come from the same file as an earlier snapshot's if
+	// they match, otherwise from the first snapshot's file patched afterwards if the patch is smaller than a new file.
+	// Different games share nothing, each just has its own file names
+	unsigned char list[8], own[6], setbln[mdrbln_len + 32], * bln = mdrbln, mainname = 'M';
+	int how[6], nlist = 0, npatch = 0, size, off; // how each is loaded, -1 shared, 0 own file or patch length
+	if (set) {
+		if (set->n && set->otek != otek && !set->games) zxerror(16); // all 48k or all 128k
+		if (!set->games) {
+			if ((set->block[set->n] = (unsigned char*)malloc((6912 + 5 * 16384) * sizeof(unsigned char))) == NULL) zxerror(8);
+			if ((comp_d = (unsigned char*)malloc((49152 - 32179) * sizeof(unsigned char))) == NULL) zxerror(8); // below paged memory
+			npatch = patcher_len;
+		}
+		for (j = 0; j < (otek ? npage + 1 : 1); j++) {
+			unsigned char* block = j ? pagejob[j - 1].fload : main48k;
+			size = j ? 16384 : 6912;
+			off = j ? 6912 + (j - 1) * 16384 : 0;
+			set->file[set->n][j] = own[j] = 0;
+			how[j] = 0;
+			if (set->games) {
+				list[nlist++] = own[j] = set->next++;
+				continue;
+			}
+			memcpy(&set->block[set->n][off], block, size);
+			for (k = 0; k < set->n; k++) if (set->file[k][j] && memcmp(&set->block[k][off], block, size) == 0) break;
+			if (k < set->n) {
+				list[nlist++] = set->file[set->n][j] = set->file[k][j]; // same as an earlier one
+				how[j] = -1;
+				continue;
+			}
+			if (set->n) {
+				i = zxpatch(&set->block[0][off], block, size, j ? 0xc000 : 0x4000, j ? 0x10 + pagenum[j - 1] : 0x10,
+					&comp_d[npatch], 49152 - 32179 - 1 - npatch);
+				if (i > 0 && i < (j ? pagejob[j - 1].len + (j == 1 ? unpack_len : 1) : len_s.rrrr)) {
+					list[nlist++] = set->file[0][j]; // first snapshot's then patched
+					npatch += how[j] = i;
+					continue;
+				}
+			}
+			list[nlist++] = set->file[set->n][j] = own[j] = set->next++;
+		}
+		if (npatch > patcher_len) list[nlist++] = set->next++; // patch goes last
+		mainname = set->next++;
+		len.rrrr = zxsetbasic(mdrbln, list, nlist, mainname, setbln);
+		bln = setbln;
+		if (set->n || set->games) mdrfname[3] = '1' + set->n; // run2, run3... or run1 on for games
+	}
+	t = zxclock();
+	if (appendmdr(&mdr, mdrfname, bln, len, start, param, 0x00, zxfilegap(ZXMDRBASIC))) zxerror(11);
+	st.assembly += zxclock() - t;
+	zxlog(log, "R(%lu)+", len.rrrr);
+	unsigned char loader[11];
+	memcpy(loader, mdrfname, sizeof(loader));
+	mdrfname[1] = mdrfname[2] = mdrfname[3] = ' ';
 	// write screen (b)
-	mdrfname[0] = '0';
-	start.rrrr = 32179;// 25088;
-	param.rrrr = 0xffff;
-	i = appendmdr(mdrname, mdrfname, cart, &sector, comp_s, len_s, start, param, 0x03);
-	fprintf(stdout, "S(%lu)+", len_s.rrrr);
-	free(comp_s);
+	if (set && how[0]) zxlog(log, how[0] < 0 ? "S(=)+" : "S(~%d)+", how[0]);
+	else {
+		mdrfname[0] = set ? own[0] : '0';
+		start.rrrr = 32179;// 25088;
+		param.rrrr = 0xffff;
+		t = zxclock();
+		i = zxfilegap(zxunpacktime(&comp_s[scrload_len], len_s.rrrr - scrload_len, 1) + ZXMDRBASIC);
+		if (appendmdr(&mdr, mdrfname, comp_s, len_s, start, param, 0x03, i)) zxerror(11);
+		st.assembly += zxclock() - t;
+		zxlog(log, "S(%lu)+", len_s.rrrr);
+	}
 	//otek pages (c)
 	if (otek) {
-		unsigned char* comp_p;
+		unsigned char* page_p;
 		rrrr len_p;
-		if ((comp_p = (unsigned char*)malloc((16384 + 512 + unpack_len) * sizeof(unsigned char))) == NULL) error(8);
-		len_p.rrrr = zxsc(&main[bank[4]], &comp_p[unpack_len], 16384, 0);
-		for (i = 0; i < unpack_len; i++) comp_p[i] = unpack[i]; // add in unpacker
-		len_p.rrrr += unpack_len;
-		fprintf(stdout, "1(%lu)+", len_p.rrrr);
+		char pname[12]; // page name for the stats
 		mdrfname[0] = '1';
-		start.rrrr = 32256 - unpack_len;
 		param.rrrr = 0xffff;
-		i = appendmdr(mdrname, mdrfname, cart, &sector, comp_p, len_p, start, param, 0x03);
-		// page 3
-		mdrfname[0]++;
-		comp_p[0] = 0x13;
-		len_p.rrrr = zxsc(&main[bank[6]], &comp_p[1], 16384, 0);
-		len_p.rrrr++;
-		fprintf(stdout, "3(%lu)+", len_p.rrrr);
-		start.rrrr = 32255; // don't need to replace the unpacker, just the page number
-		i = appendmdr(mdrname, mdrfname, cart, &sector, comp_p, len_p, start, param, 0x03);
-		// page 4
-		mdrfname[0]++;
-		comp_p[0] = 0x14;
-		len_p.rrrr = zxsc(&main[bank[7]], &comp_p[1], 16384, 0);
-		len_p.rrrr++;
-		fprintf(stdout, "4(%lu)+", len_p.rrrr);
-		i = appendmdr(mdrname, mdrfname, cart, &sector, comp_p, len_p, start, param, 0x03);
-		// page 6
-		mdrfname[0]++;
-		comp_p[0] = 0x16;
-		len_p.rrrr = zxsc(&main[bank[9]], &comp_p[1], 16384, 0);
-		len_p.rrrr++;
-		fprintf(stdout, "6(%lu)+", len_p.rrrr);
-		i = appendmdr(mdrname, mdrfname, cart, &sector, comp_p, len_p, start, param, 0x03);
-		// page 7
-		mdrfname[0]++;
-		comp_p[0] = 0x17;
-		len_p.rrrr = zxsc(&main[bank[10]], &comp_p[1], 16384, 0);
-		len_p.rrrr++;
-		fprintf(stdout, "7(%lu)+", len_p.rrrr);
-		i = appendmdr(mdrname, mdrfname, cart, &sector, comp_p, len_p, start, param, 0x03);
-		free(comp_p);
+		k = ntab ? pageops_len + ntab * 3 + 1 : 0; // pageops & table
+		for (j = 0; j < npage; j++) {
+			sprintf(pname, "page%d", pagefile[j]);
+			zxstatcall(&st, pname, pagejob[j].time, 16384, pagejob[j].len, pagejob[j].cached);
+			if (parse == PARSE_OPTIMAL) {
+				strcat(pname, "-dflt");
+				zxstatcall(&st, pname, pagejob[j].gtime, 16384, pagejob[j].greedy, 0);
+			}
+			st.compare += pagejob[j].compare;
+			if (pagejob[j].len == 0 || (parse == PARSE_OPTIMAL && pagejob[j].greedy == 0)) zxerror(8); // ran out of memory
+			zxtokens(pagejob[j].store, pagejob[j].len, &st.tok);
+			if (set && how[j + 1]) { // loaded from another snapshot's file
+				zxlog(log, how[j + 1] < 0 ? "%d(=)+" : "%d(~%d)+", pagefile[j], how[j + 1]);
+				continue;
+			}
+			if (set) mdrfname[0] = own[j + 1];
+			page_p = pagejob[j].store;
+			if (j == 0) {
+				page_p -= unpack_len + k;
+				start.rrrr = 32256 - unpack_len - k;
+				if (ntab) {
+					pageops[pageops_last] = 0x10 + pagefile[npage - 1];
+					pageops[pageops_tab] = (start.rrrr + pageops_len) & 0xff;
+					pageops[pageops_tab + 1] = (start.rrrr + pageops_len) >> 8;
+					unpack[unpack_exit] = 0xc3; // jp pageops
+					unpack[unpack_exit + 1] = start.r[0];
+					unpack[unpack_exit + 2] = start.r[1];
+					for (i = 0; i < pageops_len; i++) page_p[i] = pageops[i];
+					for (i = 0; i < k - pageops_len; i++) page_p[pageops_len + i] = pagetab[i];
+				}
+				for (i = 0; i < unpack_len; i++) page_p[k + i] = unpack[i]; // add in unpacker
+				page_p[k + unpack_len - 1] = 0x10 + pagefile[j];
+				len_p.rrrr = pagejob[j].len + unpack_len + k;
+			}
+			else {
+				page_p -= 1; // don't need to replace the unpacker, just the page number
+				page_p[0] = 0x10 + pagefile[j];
+				len_p.rrrr = pagejob[j].len + 1;
+				start.rrrr = 32255;
+			}
+			if (parse == PARSE_OPTIMAL) gain += pagejob[j].greedy - pagejob[j].len;
+			zxlog(log, "%d(%lu)+", pagefile[j], len_p.rrrr);
+			t = zxclock();
+			i = zxfilegap(zxunpacktime(pagejob[j].store, pagejob[j].len, 0) + (j == npage - 1 ? zxopstime(pagetab) : 0.0) + ZXMDRBASIC);
+			if (appendmdr(&mdr, mdrfname, page_p, len_p, start, param, 0x03, i)) zxerror(11);
+			st.assembly += zxclock() - t;
+			mdrfname[0]++;
+		}
+		for (j = 0; j < ntab; j++) { // pages filled or copied
+			if (pagetab[j * 3 + 1]) zxlog(log, "%d(=%d)+", pagetab[j * 3] - 0x10, pagetab[j * 3 + 1] == 0xff ? c : pagetab[j * 3 + 1] - 0x10);
+			else zxlog(log, "%d(=#%02x)+", pagetab[j * 3] - 0x10, pagetab[j * 3 + 2]);
+			if (pagetab[j * 3 + 1] && pagetab[j * 3 + 1] != 0xff) c = pagetab[j * 3 + 1] - 0x10;
+		}
+	}
+	// patch for the screen & pages that differ from the first snapshot
+	if (npatch > patcher_len) {
+		for (i = 0; i < patcher_len; i++) comp_d[i] = patcher[i];
+		comp_d[npatch++] = 0x00;
+		mdrfname[0] = list[nlist - 1];
+		start.rrrr = 32179;
+		param.rrrr = 0xffff;
+		len.rrrr = npatch;
+		t = zxclock();
+		i = zxfilegap(zxpatchtime(&comp_d[patcher_len], npatch - patcher_len) + ZXMDRBASIC);
+		if (appendmdr(&mdr, mdrfname, comp_d, len, start, param, 0x03, i)) zxerror(11);
+		st.assembly += zxclock() - t;
+		zxlog(log, "P(%lu)+", len.rrrr);
 	}
-	free(main);
 	// main load
+	t = zxclock();
 	if (oldl) {
 		//copy launcher & delta to screen or prtbuff
 		for (i = 0; i < launch_scr_delta; i++) comp[i + 8704 - adder] = launch_scr[i];
@@ -876,440 +1477,1225 @@ int main(int argc, char* argv[]) {
 		}
 		for (i = 0; i < noc_launchprt_len; i++) comp[i + 8704 - noc_launchprt_len] = noc_launchprt[i];
 	}
-	free(main48k);
 	// write main
-	mdrfname[0] = 'M';
+	mdrfname[0] = mainname;
 	start.rrrr = 65536 - cmsize.rrrr;
 	param.rrrr = 0xffff;
-	i = appendmdr(mdrname, mdrfname, cart, &sector, &comp[8704 - adder], cmsize, start, param, 0x03);
-	fprintf(stdout, "M(%lu:D%d", cmsize.rrrr, delta);
-	if (stshift) fprintf(stdout, "{S^}");
-	//
-	free(comp);
+	i = zxfilegap(zxunpacktime(&comp[8704], cmsize.rrrr - adder, 0) + 21.0 * adder / ZXTSTATES + ZXMDRBASIC);
+	if (appendmdr(&mdr, mdrfname, &comp[8704 - adder], cmsize, start, param, 0x03, i)) zxerror(11);
+	st.assembly += zxclock() - t;
+	zxlog(log, "M(%lu:D%d", cmsize.rrrr, delta);
+	if (stshift) zxlog(log, "{S^}");
+	if (parse == PARSE_OPTIMAL) zxlog(log, "{X-%lu}", gain); // saving over the default parser
 	//count blank sectors to determine space
-	for (i = 0xfe, j = 0; i > 0; i--) {
-		if (cart[(0xfe - i) * 543 + 15] == 0x00) j++;
+	j = zxcartfree(&mdr);
+	zxlog(log, ")>T(%d<->%d)\n", (254 - j) * 543, j * 543); // updated for interleave
+	if (opt->verify) {
+		t = zxclock();
+		if (zxverify(cart, loader, main, otek)) zxerror(17);
+		st.verify = zxclock() - t;
 	}
-	fprintf(stdout, ")>T(%d<->%d)\n", (254 - j) * 543, j * 543); // updated for interleave
-	// create file and write cartridge
-	if ((fp_out = fopen(fmdr, "wb")) == NULL) error(3); // cannot open mdr for write
-	fwrite(cart, sizeof(unsigned char), mdrsize, fp_out);
-	fclose(fp_out);
-	free(cart);
-	// all done
-	return 0;
+	if (set) { // ready for the next snapshot
+		set->mdr = mdr;
+		set->otek = otek;
+		set->n++;
+	}
+done:
+#undef zxerror
+#undef zxfilegap
+	if (pooled) zxpoolfinish(&pool); // workers may still be using the pages
+	if (opt->stats) {
+		st.compare += mainmt.compare + scrmt.compare;
+		zxstatsjson(opt->stats, &st, opt->name, err, zxclock() - t0, err ? NULL : cart);
+	}
+	if (opt->cache && !opt->cachekeep) zxcachetidy(opt->cache, opt->cachemax > 0 ? opt->cachemax : ZXCACHEMAX);
+	zxmatchfree(&mainmt);
+	zxmatchfree(&scrmt);
+	free(run);
+	free(comp_s);
+	free(comp_p);
+	free(comp_d);
+	free(comp);
+	free(main48k);
+	free(main);
+	return err;
 }
-//decompress z80 snapshot routine
-int dcz80(FILE** fp_in, unsigned char* out, int size) {
-	int i = 0, k, j;
-	unsigned char c;
+// put n snapshots of one game on one cartridge, the first is started by RUN, the rest by run2 to run9. Returns 0 if
+// ok otherwise the error code
+int z80onmdrset(const unsigned char** snapshot, const int* filesize, const int* sna, int n, unsigned char* cart, struct zxopt* opt) {
+	struct zxopt o = *opt;
+	struct zxset set;
+	int i, err = 0;
+	if (n < 1 || n > ZXSETMAX) return 16;
+	memset(&set, 0, sizeof(set));
+	set.next = '0';
+	o.set = &set;
+	o.cachekeep = 1; // tidied once all are done
+	for (i = 0; i < n && err == 0; i++) {
+		o.sna = sna[i];
+		err = z80onmdr(snapshot[i], filesize[i], cart, &o);
+	}
+	if (opt->cache && !opt->cachekeep) zxcachetidy(opt->cache, opt->cachemax > 0 ? opt->cachemax : ZXCACHEMAX);
+	for (i = 0; i < ZXSETMAX; i++) free(set.block[i]);
+	return err;
+}
+// put n different games (up to 9, sna[i] is 1 for .sna) on one cartridge after a menu BASIC that lists them by title &
+// loads run1 to run9 for the key pressed. Each game's files follow on from the last game's in the order given. Returns
+// 0 if ok otherwise the error code
+int z80onmdrpack(const unsigned char** snapshot, const int* filesize, const int* sna, const char** title, int n, unsigned char* cart, struct zxopt* opt) {
+	struct zxopt o = *opt;
+	struct zxset set;
+	unsigned char mdrname[] = "          ", mdrfname[] = "run       ", menu[ZXMENULEN];
+	rrrr len, start, param;
+	int i, err = 0;
+	if (n < 1 || n > ZXSETMAX) return 16;
+	memset(&set, 0, sizeof(set));
+	set.next = '0';
+	set.games = 1;
+	o.set = &set;
+	o.cachekeep = 1; // tidied once all are done
+	zxcartname(opt->name, mdrname);
+	zxcartblank(&set.mdr, cart, mdrname);
+	len.rrrr = zxmenubasic(title, n, menu);
+	start.rrrr = 23813;
+	param.rrrr = 10; // LINE 10
+	if (appendmdr(&set.mdr, mdrfname, menu, len, start, param, 0x00, opt->gap ? opt->gap : zxgap(ZXMDRBASIC) - zxgap(0.0))) return 11;
+	zxlog(opt->log, "Menu(%lu)\n", len.rrrr);
+	for (i = 0; i < n && err == 0; i++) {
+		zxlog(opt->log, "%d:", i + 1);
+		o.sna = sna[i];
+		err = z80onmdr(snapshot[i], filesize[i], cart, &o);
+	}
+	if (opt->cache && !opt->cachekeep) zxcachetidy(opt->cache, opt->cachemax > 0 ? opt->cachemax : ZXCACHEMAX);
+	return err;
+}
+//decompress z80 snapshot routine, reads no more than srclen bytes and returns the size decompressed or -1 if the data
+//runs out or overflows size. Everything up to the next 0xed is copied in one go
+int dcz80(struct zxin* in, unsigned char* out, int size, int srclen) {
+	const unsigned char* hl, * end, * ed;
+	int i = 0, j;
+	if (srclen > in->size - in->pos) srclen = in->size - in->pos;
+	hl = &in->buf[in->pos];
+	end = hl + srclen;
 	while (i < size) {
-		c = fgetc(*fp_in);
-		if (c == 0xed) { // is it 0xed [0]
-			c = fgetc(*fp_in); // get next
-			if (c == 0xed) { // is 2nd 0xed then a sequence
-				j = fgetc(*fp_in); // counter into j
-				c = fgetc(*fp_in);
-				for (k = 0; k < j; k++) out[i++] = c;
-			}
-			else {
-				out[i++] = 0xed;
-				fseek(*fp_in, -1, SEEK_CUR); // back one
-			}
+		j = end - hl;
+		if (j > size - i) j = size - i;
+		if ((ed = (const unsigned char*)memchr(hl, 0xed, j)) == NULL) ed = hl + j;
+		memcpy(&out[i], hl, ed - hl); // just copy
+		i += ed - hl;
+		hl = ed;
+		if (i == size) break;
+		if (hl == end) return -1; // run out of data
+		if (hl + 1 < end && hl[1] == 0xed) { // is 2nd 0xed then a sequence
+			if (end - hl < 4 || hl[2] > size - i) return -1; // cut short or too long
+			memset(&out[i], hl[3], hl[2]);
+			i += hl[2];
+			hl += 4;
 		}
 		else {
-			out[i++] = c; // just copy
+			out[i++] = 0xed; // single 0xed
+			hl++;
 		}
 	}
+	in->pos = hl - in->buf;
 	return i;
 }
-// structure to store for each byte the max length, offset, the byte itself and the cost to end which is then used to optimise the
-// compression. It is also used to create a linear version of the screen
+// match search & parse settings for each compression level, 0 is the default which is the same as 9
+struct zxlevel {
+	int window; // furthest back a match is looked for
+	int chain; // candidates looked at for each byte nearest first, 0 for every one in the window oldest first
+	int nice; // stop looking once a match this long is found
+	int refine; // 1 to shorten matches from the cost to the end, 0 to take the longest every time
+};
+static const struct zxlevel zxlevels[10] = {
+	{ MAXOFFSET, 0, MAXLENGTH, 1 },
+	{ 2048, 1, 16, 0 },
+	{ 4096, 4, 32, 0 },
+	{ MAXOFFSET, 8, 32, 0 },
+	{ MAXOFFSET, 16, 64, 0 },
+	{ MAXOFFSET, 32, 128, 0 },
+	{ MAXOFFSET, 64, MAXLENGTH, 0 },
+	{ MAXOFFSET, 32, MAXLENGTH, 1 },
+	{ MAXOFFSET, 128, MAXLENGTH, 1 },
+	{ MAXOFFSET, 0, MAXLENGTH, 1 }
+};
+#define zxlevel(n) (&zxlevels[(n) > 0 && (n) < 9 ? (n) : 0])
+// longest match found for a byte
 struct loj {
-	rrrr length;
-	rrrr offset;
-	unsigned char byte;
-	float cost;
+	unsigned short length;
+	unsigned short offset;
 };
+// hash index for the linear match finder. Every position that can start a match is filed under a hash of its first
+// MINLENGTH bytes and each bucket keeps its positions in ascending order, so a bucket can be walked from the start of the
+// window forwards in the same order as the old brute force search, which keeps the chosen length & offset identical
+struct zxhash {
+	int* bucket; // start of each bucket within pos, (1 << HASHBITS) + 1 entries
+	int* first; // first entry of each bucket still inside the window
+	int* pos; // positions grouped by bucket
+	int (*matchlen)(const unsigned char* a, const unsigned char* b, int max); // best match length kernel for this CPU
+	unsigned long compare; // candidates looked at
+};
+// screen layout order used by the screen compressor, attr then the 8 pixel rows of that char then the next attr,
+// generated at compile time so the screen can be put into a linear buffer in one pass
+#define ZXO_PIX(c, r) (((c) & 0x300) << 3 | (r) << 8 | ((c) & 0xff)) // pixel row r of char c
+#define ZXO_CHR(c) 6144 + (c), ZXO_PIX(c, 0), ZXO_PIX(c, 1), ZXO_PIX(c, 2), ZXO_PIX(c, 3), ZXO_PIX(c, 4), ZXO_PIX(c, 5), \
+	ZXO_PIX(c, 6), ZXO_PIX(c, 7)
+#define ZXO_4(c) ZXO_CHR(c), ZXO_CHR((c) + 1), ZXO_CHR((c) + 2), ZXO_CHR((c) + 3)
+#define ZXO_16(c) ZXO_4(c), ZXO_4((c) + 4), ZXO_4((c) + 8), ZXO_4((c) + 12)
+#define ZXO_64(c) ZXO_16(c), ZXO_16((c) + 16), ZXO_16((c) + 32), ZXO_16((c) + 48)
+#define ZXO_256(c) ZXO_64(c), ZXO_64((c) + 64), ZXO_64((c) + 128), ZXO_64((c) + 192)
+static const unsigned short zxorder[6912] = { ZXO_256(0), ZXO_256(256), ZXO_256(512) };
+#define zxhashkey(b) ((((unsigned int)(b)[0] << 16 | (unsigned int)(b)[1] << 8 | (b)[2]) * 2654435761U) >> (32 - HASHBITS))
 //zxsc modified lzf compressor
-unsigned long zxsc(unsigned char* fload, unsigned char* store, int filesize, int screen) {
-	unsigned char* buffer_ss, * store_c, * store_l;
-	struct loj* tryall, * tryall_p, * tryall_c;
-	int i, j;
+unsigned long zxsc(unsigned char* fload, unsigned char* store, int filesize, int screen, struct zxmatch* mt, int parse, int level) {
+	unsigned char* store_c, * store_l;
+	unsigned char scrlinear[6912];
+	unsigned short* length, * offset;
+	float* cost;
+	struct zxmatch own = { 0 };
+	int i, j, p, c, refine = zxlevel(level)->refine;
 	float costsum;
-	// get max length & offset for each byte into tyrall array, this also reorgs a screen input file to a linear sequence
-	if ((tryall = (struct loj*)malloc(filesize * sizeof(struct loj))) == NULL) error(8); // cannot create array
-	tryall_p = tryall; // move pointer to start of storage
-	if (screen) buffer_ss = fload + 6144; // move screen check start to start of attr space
-	else buffer_ss = fload; // move screen check start to start of buffer
-	tryall_p->length.rrrr = 0;
-	tryall_p->offset.rrrr = 0;
-	tryall_p->cost = 0.0;
-	tryall_p++->byte = *buffer_ss; // copy first as literal with control byte
-	if (screen) { // screen version follows screen layout starting at attributes
-		while (zxlayout(fload, &buffer_ss) < 6912) { // move buffer start check on one and check not at end of the screen
-			*tryall_p++ = findmatch(fload, buffer_ss);
-		}
-	}
-	else { // normal version just linear
-		while (++buffer_ss - fload < filesize) { // move screen start check on one and check not at end of the screen
-			*tryall_p++ = findmatch2(fload, buffer_ss, filesize);
-		}
-	}
-	// calculate cost to end for each byte, uses greedy parser, backwards version with re-use for massive speed-up
-	tryall_p = tryall + filesize - 1; // move byte pointer to end
-	tryall_p->cost = 1.0;
-	for (tryall_p--; tryall_p > tryall; tryall_p--) {
-		tryall_c = tryall_p; // count pointer to current byte pointer
-		if (tryall_c->length.rrrr == 0) {
+	// get max length & offset for each byte into separate arrays, this also reorgs a screen input file to a linear sequence
+	if (screen) { // screen version follows screen layout starting at attributes, so put it in that order first
+		for (i = 0; i < 6912; i++) scrlinear[i] = fload[zxorder[i]];
+		fload = scrlinear;
+	}
+	if (mt == NULL) mt = &own; // nothing to reuse
+	length = (unsigned short*)malloc(filesize * sizeof(unsigned short));
+	offset = (unsigned short*)malloc(filesize * sizeof(unsigned short));
+	cost = (float*)malloc(filesize * sizeof(float));
+	if (length == NULL || offset == NULL || cost == NULL || zxmatches(mt, fload, filesize, screen, level)) {
+		free(length);
+		free(offset);
+		free(cost);
+		zxmatchfree(&own);
+		return 0; // cannot create array, 0 as a compressed block is never empty
+	}
+	memcpy(length, mt->length, filesize * sizeof(unsigned short)); // copied as the parse changes them
+	memcpy(offset, mt->offset, filesize * sizeof(unsigned short));
+	zxmatchfree(&own);
+	if (parse != PARSE_GREEDY) {
+		i = zxscoptimal(fload, length, offset, store, filesize, screen, parse == PARSE_TSTATE ? (screen ? &zxcostscreen : &zxcostlinear) : &zxcostsize);
+		free(length);
+		free(offset);
+		free(cost);
+		return i;
+	}
+	// calculate cost to end for each byte, uses greedy parser, backwards version with re-use for massive speed-up. The
+	// quickest levels skip it & take the longest match every time
+	cost[0] = 0.0;
+	p = filesize - 1; // move byte pointer to end
+	cost[p] = 1.0;
+	for (p = refine ? p - 1 : 0; p > 0; p--) {
+		c = p; // count pointer to current byte pointer
+		if (length[c] == 0) {
 			costsum = 1.0;  //literal needs 1bytes
-			tryall_c++;
+			c++;
 			// penalise literal followed by match by size of match, longer the match smaller the penalty
-			if (tryall_c->length.rrrr != 0) costsum += (1.0 / (float)(tryall_c->length.rrrr)) / 10.0;
+			if (length[c] != 0) costsum += (1.0 / (float)(length[c])) / 10.0;
 		}
 		else {
-			j = tryall_c->length.rrrr;
-			if (tryall_c + tryall_c->length.rrrr - tryall<filesize && j>MINLENGTH) {
-				for (i = MINLENGTH; i < tryall_c->length.rrrr; i++) {
-					if ((tryall_c + i)->cost < (tryall_c + j)->cost) j = i;
+			j = length[c];
+			if (c + length[c] < filesize && j > MINLENGTH) {
+				for (i = MINLENGTH; i < length[c]; i++) {
+					if (cost[c + i] < cost[c + j]) j = i;
 				}
-				tryall_c->length.rrrr = j; //adjust if it can find a better route
+				length[c] = j; //adjust if it can find a better route
 			}
-			if (tryall_c->length.rrrr < 9) costsum = 2.0;
+			if (length[c] < 9) costsum = 2.0;
 			else costsum = 3.0; // if length 3-8 then 2 else 3 cost
-			tryall_c += tryall_c->length.rrrr; // move it on the match length
+			c += length[c]; // move it on the match length
 		}
-		if (tryall_c - tryall < filesize) costsum += tryall_c->cost;
-		tryall_p->cost = costsum; // write cost to end for current byte
+		if (c < filesize) costsum += cost[c];
+		cost[p] = costsum; // write cost to end for current byte
 	}
-	tryall_p->cost = 2.0 + (tryall_p + 1)->cost;									  
-	tryall_p = tryall; // move byte pointer to the start
+	if (refine) cost[p] = 2.0 + cost[p + 1];
+	p = 0; // move byte pointer to the start
 	store_c = store; // control byte pointer -> start of storage
 	store_l = store + 1; // literal store pointer -> start of storage+1
 	(*store_c) = 255; // set initial control byte to 255 (clear)
 	do {
-		if (tryall_p->length.rrrr != 0) { //  if not a literal then check for a lower cost alternative is available
-			for (j = 0, i = 1; i < tryall_p->length.rrrr; i++) { // look over the full match length to see if there is a better match
+		if (refine && length[p] != 0) { //  if not a literal then check for a lower cost alternative is available
+			for (j = 0, i = 1; i < length[p]; i++) { // look over the full match length to see if there is a better match
 				//
 				// check if adding literals makes a difference
 				if (i < MINLENGTH) {
 					if (*store_c + i > 31) { // also capture if it is a control byte 255
-						if ((tryall_p + i)->cost + (float)i + 1.0 < (tryall_p + j)->cost) j = i;
+						if (cost[p + i] + (float)i + 1.0 < cost[p + j]) j = i;
 					}
-					else if ((tryall_p + i)->cost + (float)i < (tryall_p + j)->cost) j = i;
+					else if (cost[p + i] + (float)i < cost[p + j]) j = i;
 				}
 				else if (i < 9) {
-					if ((tryall_p + i)->cost + 2.0 < (tryall_p + j)->cost) j = i; // add 2 to mimic storage of 3-8 match
+					if (cost[p + i] + 2.0 < cost[p + j]) j = i; // add 2 to mimic storage of 3-8 match
 				}
-				else if ((tryall_p + i)->cost + 3.0 < (tryall_p + j)->cost) j = i; // add 3 to mimic storage of 9+ match
+				else if (cost[p + i] + 3.0 < cost[p + j]) j = i; // add 3 to mimic storage of 9+ match
 			}
 			if (j != 0) { // if j=0 then nothing better found so just continue
 				if (j < MINLENGTH) { // is it 1 or 2 ahead?
-					for (i = 0; i < j; i++) (tryall_p + i)->length.rrrr = 0; // change to a literal
+					for (i = 0; i < j; i++) length[p + i] = 0; // change to a literal
 				}
-				else tryall_p->length.rrrr = j; // if j>2 then just change to new length
+				else length[p] = j; // if j>2 then just change to new length
 			}
 		}
 		// now store either an offset+length or a literal
-		if (tryall_p->length.rrrr != 0) { // offset+length
-			if (screen == 0) tryall_p->offset.rrrr--; // reduce offset by one for normal only     
+		if (length[p] != 0) { // offset+length
+			if (screen == 0) offset[p]--; // reduce offset by one for normal only     
 			if (*store_c != 255) {
 				store_c = store_l++; // if control is not clear move to literal store and move that on one
 			}
-			i = tryall_p->length.rrrr - 1; // store length-1 for later jump
-			if ((tryall_p->length.rrrr -= 2) > 6) { // reduce by 2 so 3->1, 8->6 etc... and check if >6
-				tryall_p->length.rrrr -= 7; // if >6 then reduce max length by 7 to get length to store
-				*(store_l++) = tryall_p->length.r[0]; // store 2nd part of length in literal store and move literal byte on one
-				tryall_p->length.rrrr = 7; // make length 7 for offset control byte
+			i = length[p] - 1; // store length-1 for later jump
+			if ((length[p] -= 2) > 6) { // reduce by 2 so 3->1, 8->6 etc... and check if >6
+				length[p] -= 7; // if >6 then reduce max length by 7 to get length to store
+				*(store_l++) = (unsigned char)length[p]; // store 2nd part of length in literal store and move literal byte on one
+				length[p] = 7; // make length 7 for offset control byte
 			}
-			*store_c = ((tryall_p->length.r[0]) << 5) + tryall_p->offset.r[1]; // shift length 5 bits to left and bring in offset hi byte
-			*(store_l++) = tryall_p->offset.r[0]; // offset low byte in next byte and move on one
+			*store_c = (length[p] << 5) + (offset[p] >> 8); // shift length 5 bits to left and bring in offset hi byte
+			*(store_l++) = offset[p] & 0xff; // offset low byte in next byte and move on one
 			store_c = store_l++; // move control byte up, byte store on one
 			*store_c = 255; // clear new control byte
-			tryall_p += i; // jump forward to next byte
+			p += i; // jump forward to next byte
 		}
 		else { // store a literal
-			*(store_l++) = tryall_p->byte; // copy new literal into byte store and move byte store on one
-			if (++(*store_c) == 31 || (tryall_p - tryall) == filesize - 1) { // increase control byte by one and check if at max or at end of file
+			*(store_l++) = fload[p]; // copy new literal into byte store and move byte store on one
+			if (++(*store_c) == 31 || p == filesize - 1) { // increase control byte by one and check if at max or at end of file
 				store_c = store_l++; // move new control to literal and move literal on one
 				*store_c = 255; // clear new control byte
 			}
 		}
-	} while (++tryall_p - tryall < filesize); // move start check on one and check not at end of the compression 
+	} while (++p < filesize); // move start check on one and check not at end of the compression 
 	//
 	//	
-	free(tryall);
+	free(length);
+	free(offset);
+	free(cost);
 	return (store_l - store);
 }
-//screen version, attr then pixels char row then back to attr
-struct loj findmatch(unsigned char* buffer, unsigned char* buffer_ss) {
-	unsigned char* buffer_sc, // pointer to screen check position
-		* buffer_ds, // pointer to dictionary start position
-		* buffer_dc; // pointer to dictionary check position
-	struct loj output; // store length, offset, byte & cost
-	unsigned short int len;
-	output.byte = *buffer_ss; // copy byte to compare to output
-	output.offset.rrrr = 0; // set offset to 0
-	output.length.rrrr = 0; // set session max match length to zero
-						  //
-						  // match routine
-	buffer_ds = buffer + 6144; // initial dictionary start to start of screen attr space
+// zxsc through the cache folder, the entry is named from a hash of the block & the settings that change the output. It
+// holds a 2nd hash to check it is the right block, then the compressed block. New entries are written to a temporary
+// file first so a half written one is never found. cached is set to 1 if it was found
+unsigned long zxsccache(const char* cache, unsigned char* fload, unsigned char* store, int filesize, int screen, struct zxmatch* mt, int parse, int level, int* cached) {
+	unsigned char head[16], param[16];
+	unsigned long long key, check;
+	unsigned long len = 0;
+	char path[1024], tmp[1100];
+	FILE* fp;
+	int i;
+	*cached = 0;
+	if (cache == NULL) return zxsc(fload, store, filesize, screen, mt, parse, level);
+	param[0] = ZXCACHEVER;
+	param[1] = screen;
+	param[2] = parse | (zxlevel(level) - zxlevels) << 4; // 0 for the default level so older entries still match
+	for (i = 0; i < 4; i++) param[3 + i] = filesize >> (i * 8) & 0xff;
+	key = zxfnv(fload, filesize, zxfnv(param, 7, 14695981039346656037ULL));
+	check = zxfnv(fload, filesize, zxfnv(param, 7, 0x5a58534320435243ULL)); // different start
+	snprintf(path, sizeof(path), "%s/%016llx.zxc", cache, key);
+	if ((fp = fopen(path, "rb")) != NULL) {
+		// "ZXC" version, check hash, compressed length
+		if (fread(head, 1, 16, fp) == 16 && memcmp(head, "ZXC", 3) == 0 && head[3] == ZXCACHEVER) {
+			for (i = 0; i < 8; i++) if (head[4 + i] != (check >> (i * 8) & 0xff)) break;
+			len = head[12] | head[13] << 8 | (unsigned long)head[14] << 16;
+			if (i == 8 && len > 0 && len <= filesize + filesize / 32 + 2 && fread(store, 1, len, fp) == len) *cached = 1;
+		}
+		fclose(fp);
+		if (*cached) {
+			utime(path, NULL); // most recently used
+			return len;
+		}
+	}
+	if ((len = zxsc(fload, store, filesize, screen, mt, parse, level)) == 0) return 0;
+	memcpy(head, "ZXC", 3);
+	head[3] = ZXCACHEVER;
+	for (i = 0; i < 8; i++) head[4 + i] = check >> (i * 8) & 0xff;
+	head[12] = len & 0xff;
+	head[13] = len >> 8 & 0xff;
+	head[14] = len >> 16 & 0xff;
+	head[15] = 0;
+#ifdef _WIN32
+	snprintf(tmp, sizeof(tmp), "%s.%d.%p.tmp", path, _getpid(), (void*)&fp); // unique to this process & thread
+#else
+	snprintf(tmp, sizeof(tmp), "%s.%d.%p.tmp", path, (int)getpid(), (void*)&fp);
+#endif
+	if ((fp = fopen(tmp, "wb")) == NULL) return len; // cache isn't there, just carry on
+	i = fwrite(head, 1, 16, fp) == 16 && fwrite(store, 1, len, fp) == len;
+	if (fclose(fp) != 0 || !i || rename(tmp, path) != 0) remove(tmp); // rename fails on Windows if another got there first
+	return len;
+}
+// 64bit FNV-1a hash of n bytes carrying on from h
+unsigned long long zxfnv(const unsigned char* b, int n, unsigned long long h) {
+	int i;
+	for (i = 0; i < n; i++) {
+		h ^= b[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+// keep the cache folder under max bytes by removing the entries that were used longest ago
+void zxcachetidy(const char* cache, long max) {
+	struct zxcachefile* file = NULL, * grow;
+	char path[1100];
+	long long total = 0;
+	int n = 0, nmax = 0, i;
+#ifdef _WIN32
+	WIN32_FIND_DATAA fd;
+	HANDLE h;
+	snprintf(path, sizeof(path), "%s\\*.zxc", cache);
+	if ((h = FindFirstFileA(path, &fd)) == INVALID_HANDLE_VALUE) return;
 	do {
-		len = 0; // reset current match length to zero
-		buffer_dc = buffer_ds; // move dictionary check pos to dictionary start
-		buffer_sc = buffer_ss; // move screen check pos to screen start
-							   //
-							   // if the bytes match keep checking    
-		while (*buffer_sc == *buffer_dc) { // if screen check=dictionary keep checking
-			if (++(len) == MAXLENGTH) break; // increase length and if at max break out of inner loop
-			if (zxlayout(buffer, &buffer_sc) == 6912) break; // move screen check pos on one and if at end of screen break out out of inner loop
-			zxlayout(buffer, &buffer_dc); // move dictionary on one, can go beyond current dictionary end as extra dictionary would be built up before it got to this part
-		}
-		//
-		// check entire dictionary for max match
-		if (len > 2 && len > output.length.rrrr) { // bigger than min size and previous maximum?
-			output.length.rrrr = len; // new max found so store
-			output.offset.rrrr = buffer_ds - buffer; // calc memory position from start for new maximum
-		}
-		if ((buffer_sc - buffer) == 6912 || len == MAXLENGTH) break; // check if end of screen or max size reached -> break out of loop
-	} while (zxlayout(buffer, &buffer_ds) - (buffer_ss - buffer) != 0); // moves start of dictionary on one and checks if caught up
-	return output;
+		char* name = fd.cFileName;
+		long size = (long)fd.nFileSizeLow;
+		long long time = (long long)fd.ftLastWriteTime.dwHighDateTime << 32 | fd.ftLastWriteTime.dwLowDateTime;
+#else
+	DIR* dir;
+	struct dirent* ent;
+	struct stat st;
+	if ((dir = opendir(cache)) == NULL) return;
+	while ((ent = readdir(dir)) != NULL) {
+		char* name = ent->d_name;
+		i = strlen(name);
+		if (i < 4 || strcmp(&name[i - 4], ".zxc") != 0) continue;
+		snprintf(path, sizeof(path), "%s/%s", cache, name);
+		if (stat(path, &st) != 0) continue;
+		long size = (long)st.st_size;
+		long long time = (long long)st.st_mtime;
+#endif
+		if (strlen(name) >= sizeof(file[0].name)) continue; // not one of ours
+		if (n == nmax) {
+			nmax = nmax ? nmax * 2 : 256;
+			if ((grow = (struct zxcachefile*)realloc(file, nmax * sizeof(struct zxcachefile))) == NULL) break;
+			file = grow;
+		}
+		strcpy(file[n].name, name);
+		file[n].size = size;
+		file[n].time = time;
+		total += size;
+		n++;
+#ifdef _WIN32
+	} while (FindNextFileA(h, &fd));
+	FindClose(h);
+#else
+	}
+	closedir(dir);
+#endif
+	if (total > max) {
+		qsort(file, n, sizeof(struct zxcachefile), zxcachecmp); // oldest first
+		for (i = 0; i < n && total > max; i++) {
+			snprintf(path, sizeof(path), "%s/%s", cache, file[i].name);
+			if (remove(path) == 0) total -= file[i].size;
+		}
+	}
+	free(file);
+}
+int zxcachecmp(const void* a, const void* b) {
+	const struct zxcachefile* fa = (const struct zxcachefile*)a, * fb = (const struct zxcachefile*)b;
+	return fa->time < fb->time ? -1 : fa->time > fb->time;
 }
-//follow the screen layout rather than linear
-unsigned long int zxlayout(unsigned char* s, unsigned char** c) {
-	rrrr pos; // position stored as union rr so it can be split into two bytes, hi & lo
-	pos.rrrr = *c - s; // calculate current memory position and store as union rr
-	if (pos.r[1] >= 24) { // if high byte >=24 then in attr space >=6144bytes
-		pos.r[1] = pos.r[1] & 7; // and %00000111
-		pos.r[1] = pos.r[1] << 3; // rotate hi byte to left x3 or move to pixel space -> 6144 to 0 etc...
+// make the cache folder if it isn't there yet, returns 0 if it is a folder afterwards
+int zxcachedir(const char* cache) {
+	struct stat st;
+#ifdef _WIN32
+	_mkdir(cache);
+#else
+	mkdir(cache, 0777);
+#endif
+	return stat(cache, &st) != 0 || (st.st_mode & S_IFMT) != S_IFDIR;
+}
+// exact optimal parse, works out the smallest cost to the end from every byte then follows the cheapest route. With
+// zxcostsize the cost is in whole bytes: a literal run costs its length+1 for the control byte (max 32 per control
+// byte), a match of 3-8 costs 2 and 9+ costs 3. With T-state costs each byte is the time to load it plus the time
+// each token takes to unpack. Any shorter length of a match can be used as it is still a match at the same offset
+unsigned long zxscoptimal(unsigned char* fload, unsigned short* length, unsigned short* offset, unsigned char* store, int filesize, int screen, const struct zxcost* k) {
+	unsigned char* store_l;
+	int* cost, * route; // route>0 is a match length, route<0 a literal run length
+	int i, j, c;
+	cost = (int*)malloc((filesize + 1) * sizeof(int));
+	route = (int*)malloc(filesize * sizeof(int));
+	if (cost == NULL || route == NULL) {
+		free(cost);
+		free(route);
+		return 0;
 	}
-	else {
-		pos.r[1]++; // in pixel space so increment high byte to move down one char row
-		if ((pos.r[1] & 7) == 0) { // if and %00000111=0 then hi byte has just crossed into the next char so need to move back to attr space
-			pos.r[1]--; // go back up one pixel row so conversion to attr space works
-			pos.r[1] = pos.r[1] >> 3; // rotate hi byte to right x3
-			pos.r[1] = pos.r[1] & 3; // and %00000011 to keep first two bits
-			pos.r[1] = pos.r[1] | 24; // or in %00011000 to move back to attr space preserving char column and row >=6144
-			pos.rrrr++; // move onto next char
+	cost[filesize] = k->byte; // end marker
+	for (i = filesize - 1; i >= 0; i--) {
+		cost[i] = 0x7fffffff;
+		for (j = 1; j <= 32 && i + j <= filesize; j++) { // literal runs
+			c = cost[i + j] + (j + 1) * k->byte + k->lit + j * k->litbyte;
+			if (c < cost[i]) {
+				cost[i] = c;
+				route[i] = -j;
+			}
+		}
+		for (j = MINLENGTH; j <= length[i]; j++) { // matches, longest wins a tie as it unpacks faster
+			c = cost[i + j] + (j < 9 ? 2 * k->byte : 3 * k->byte + k->longmatch) + k->match + j * k->matchbyte;
+			if (c <= cost[i]) {
+				cost[i] = c;
+				route[i] = j;
+			}
+		}
+	}
+	store_l = store;
+	for (i = 0; i < filesize; i += j) {
+		if (route[i] > 0) { // offset+length
+			j = route[i];
+			c = offset[i];
+			if (screen == 0) c--; // reduce offset by one for normal only
+			if (j > 8) {
+				*(store_l++) = (7 << 5) + (c >> 8); // length 7 means the length is in the next byte
+				*(store_l++) = j - 9;
+			}
+			else *(store_l++) = ((j - 2) << 5) + (c >> 8); // 3->1, 8->6
+			*(store_l++) = c & 0xff; // offset low byte
+		}
+		else { // literals
+			j = -route[i];
+			*(store_l++) = j - 1;
+			memcpy(store_l, &fload[i], j);
+			store_l += j;
 		}
 	}
-	*c = s + pos.rrrr; // move pointer to new position
-	return pos.rrrr; // return byte position as an int
+	*(store_l++) = 255; // end marker
+	free(cost);
+	free(route);
+	return (store_l - store);
 }
-//linear version
-struct loj findmatch2(unsigned char* buffer, unsigned char* buffer_ss, int filesize) {
-	unsigned char* buffer_sc, * buffer_ds, * buffer_dc;
+// size the block would compress to with the default parser, used to report what the optimal parser saves
+unsigned long zxscgreedy(unsigned char* fload, int filesize, int screen, struct zxmatch* mt, int level) {
+	unsigned char* store;
+	unsigned long len;
+	if ((store = (unsigned char*)malloc((filesize + filesize / 32 + 2) * sizeof(unsigned char))) == NULL) return 0;
+	len = zxsc(fload, store, filesize, screen, mt, PARSE_GREEDY, level);
+	free(store);
+	return len;
+}
+//linear version, only checks the positions in the hash bucket of the current byte
+struct loj findmatch2(unsigned char* buffer, unsigned char* buffer_ss, int filesize, struct zxhash* hash) {
+	unsigned char* buffer_ds;
 	struct loj output;
-	unsigned short int len;
-	output.byte = *buffer_ss; // copy byte
-	output.offset.rrrr = 0;
-	output.length.rrrr = 0; // set session max match length to zero
-	if ((buffer_ss - buffer) - 7936 < 0) buffer_ds = buffer;
-	else buffer_ds = buffer_ss - 7936; // initial dictionary start to current pos - max offset
-	do {
-		len = 0; // reset current match length to zero
-		buffer_dc = buffer_ds; // move dictionary check pos to dictionary start
-		buffer_sc = buffer_ss; // move screen check pos to screen start
-		while (*buffer_sc == *buffer_dc) {
-			if (++(len) == MAXLENGTH) break; // increase length and check aginst max length possible -> break out of inner loop
-			if (++buffer_sc - buffer == filesize) break; // move screen check pos on one & check if at end of screen -> break out out of inner loop
-			++buffer_dc; // can go beyond current dictionary end as extra dictionary would be built up before it got to this part
-		}
-		if (len >= MINLENGTH && len > output.length.rrrr) { // bigger than min size and previous maximum?
-			output.length.rrrr = len; // new max found so store
-			output.offset.rrrr = (unsigned short int)(buffer_ss - buffer_ds); // calc offset
-		}
-		if ((buffer_sc - buffer) == filesize || len == MAXLENGTH) break; // check at end of screen or max size reached -> break out of loop
-	} while (++buffer_ds != buffer_ss != 0); // moves start of dictionary on one and checks if caught up
+	unsigned short int len, maxlen;
+	int ss, h, * cand;
+	output.offset = 0;
+	output.length = 0; // set session max match length to zero
+	ss = buffer_ss - buffer;
+	if (ss > filesize - MINLENGTH) return output; // too near the end for a match
+	maxlen = MAXLENGTH;
+	if (filesize - ss < MAXLENGTH) maxlen = filesize - ss; // cannot match beyond the end of the file
+	h = zxhashkey(buffer_ss);
+	cand = &hash->pos[hash->first[h]];
+	while (*cand < ss - MAXOFFSET) cand++; // skip positions that have dropped out of the window
+	hash->first[h] = cand - hash->pos; // window only moves forward so never need to look at these again
+	for (; *cand < ss; cand++) { // bucket always holds the current position so this stops there
+		hash->compare++;
+		buffer_ds = buffer + *cand; // dictionary start
+		if (buffer_ds[output.length] != buffer_ss[output.length]) continue; // cannot beat current maximum
+		len = hash->matchlen(buffer_ss, buffer_ds, maxlen); // can go beyond current position as before
+		if (len >= MINLENGTH && len > output.length) { // bigger than min size and previous maximum?
+			output.length = len; // new max found so store
+			output.offset = (unsigned short int)(buffer_ss - buffer_ds); // calc offset
+			if (len == maxlen) break; // cannot do better than this
+		}
+	}
+	return output;
+}
+// nearest first version for the faster levels, looks at no more than chain candidates & stops at a nice length. Adds
+// the position to the chains once done
+struct loj findmatchchain(unsigned char* buffer, int ss, int filesize, struct zxchain* chain) {
+	unsigned char* buffer_ss = buffer + ss, * buffer_ds;
+	struct loj output;
+	int len, maxlen, cand, n;
+	output.offset = 0;
+	output.length = 0;
+	if (ss > filesize - MINLENGTH) return output; // too near the end for a match
+	maxlen = filesize - ss < MAXLENGTH ? filesize - ss : MAXLENGTH;
+	for (cand = chain->head[zxhashkey(buffer_ss)], n = chain->chain; cand >= 0 && cand >= ss - chain->window && n > 0; cand = chain->prev[cand], n--) {
+		chain->compare++;
+		buffer_ds = buffer + cand;
+		if (buffer_ds[output.length] != buffer_ss[output.length]) continue; // cannot beat current maximum
+		len = chain->matchlen(buffer_ss, buffer_ds, maxlen);
+		if (len >= MINLENGTH && len > output.length) { // nearest wins a tie
+			output.length = len;
+			output.offset = ss - cand;
+			if (len == maxlen || len >= chain->nice) break; // long enough
+		}
+	}
+	zxchainadd(buffer, ss, filesize, chain);
 	return output;
 }
+void zxchainadd(unsigned char* buffer, int ss, int filesize, struct zxchain* chain) {
+	int h;
+	if (ss > filesize - MINLENGTH) return; // no hash this near the end
+	h = zxhashkey(&buffer[ss]);
+	chain->prev[ss] = chain->head[h];
+	chain->head[h] = ss;
+}
+// find the longest match for each byte of the buffer, reusing the last results for any byte whose window has not changed
+int zxmatches(struct zxmatch* mt, unsigned char* buffer, int filesize, int screen, int level) {
+	struct zxhash hash;
+	struct loj match;
+	int i, j, keep;
+	if (filesize > mt->max) { // need more space so cannot reuse anything
+		zxmatchfree(mt);
+		mt->prev = (unsigned char*)malloc(filesize * sizeof(unsigned char));
+		mt->length = (unsigned short*)malloc(filesize * sizeof(unsigned short));
+		mt->offset = (unsigned short*)malloc(filesize * sizeof(unsigned short));
+		mt->dirty = (int*)malloc((filesize + 1) * sizeof(int));
+		if (mt->prev == NULL || mt->length == NULL || mt->offset == NULL || mt->dirty == NULL) {
+			zxmatchfree(mt);
+			return 8;
+		}
+		mt->max = filesize;
+	}
+	keep = mt->size; // 0 if all need finding
+	if (keep) {
+		for (i = 0; i <= filesize; i++) mt->dirty[i] = 0;
+		if (keep > filesize) keep = filesize;
+		// a match depends on the window before it and up to MAXLENGTH bytes after, so a changed byte means every
+		// position from MAXLENGTH-1 before it to MAXOFFSET after it needs searching again
+		for (i = 0; i < keep; i++) {
+			if (buffer[i] != mt->prev[i]) {
+				mt->dirty[i - MAXLENGTH + 1 < 0 ? 0 : i - MAXLENGTH + 1]++;
+				mt->dirty[i + MAXOFFSET + 1 > filesize ? filesize : i + MAXOFFSET + 1]--;
+			}
+		}
+		// matches near the end are limited by the size so redo them if that has changed
+		if (mt->size != filesize) {
+			mt->dirty[keep - MAXLENGTH < 0 ? 0 : keep - MAXLENGTH]++;
+			mt->dirty[filesize]--;
+		}
+	}
+	if (zxlevel(level)->chain) { // faster level
+		struct zxchain chain = { NULL, NULL, zxlevel(level)->window, zxlevel(level)->chain, zxlevel(level)->nice, zxmatchlenpick(), 0 };
+		chain.head = (int*)malloc((1 << HASHBITS) * sizeof(int));
+		chain.prev = (int*)malloc(filesize * sizeof(int));
+		if (chain.head == NULL || chain.prev == NULL) {
+			free(chain.head);
+			free(chain.prev);
+			mt->size = 0;
+			return 8;
+		}
+		for (i = 0; i < 1 << HASHBITS; i++) chain.head[i] = -1;
+		zxchainadd(buffer, 0, filesize, &chain);
+		mt->length[0] = mt->offset[0] = 0; // first is always a literal
+		for (i = 1, j = keep ? mt->dirty[0] : 1; i < filesize; i++) {
+			if (keep) {
+				j += mt->dirty[i];
+				if (j == 0) { // nothing changed so keep last result, still has to be in the chains
+					zxchainadd(buffer, i, filesize, &chain);
+					continue;
+				}
+			}
+			match = findmatchchain(buffer, i, filesize, &chain);
+			mt->length[i] = match.length;
+			mt->offset[i] = match.offset;
+			if (screen && match.length) mt->offset[i] = zxorder[i - match.offset];
+		}
+		mt->compare += chain.compare;
+		free(chain.head);
+		free(chain.prev);
+		for (i = 0; i < filesize; i++) mt->prev[i] = buffer[i];
+		mt->size = filesize;
+		return 0;
+	}
+	if (zxhashbuild(&hash, buffer, filesize)) {
+		mt->size = 0; // half done so nothing can be reused
+		return 8;
+	}
+	mt->length[0] = mt->offset[0] = 0; // first is always a literal
+	for (i = 1, j = keep ? mt->dirty[0] : 1; i < filesize; i++) {
+		if (keep) {
+			j += mt->dirty[i]; // running count of changes covering this position
+			if (j == 0) continue; // nothing changed so keep last result
+		}
+		match = findmatch2(buffer, &buffer[i], filesize, &hash);
+		mt->length[i] = match.length;
+		mt->offset[i] = match.offset;
+		// screen matches store the screen address of the match rather than the offset
+		if (screen && match.length) mt->offset[i] = zxorder[i - match.offset];
+	}
+	mt->compare += hash.compare;
+	free(hash.bucket);
+	free(hash.first);
+	free(hash.pos);
+	for (i = 0; i < filesize; i++) mt->prev[i] = buffer[i];
+	mt->size = filesize;
+	return 0;
+}
+void zxmatchfree(struct zxmatch* mt) {
+	free(mt->prev);
+	free(mt->length);
+	free(mt->offset);
+	free(mt->dirty);
+	mt->prev = NULL;
+	mt->length = mt->offset = NULL;
+	mt->dirty = NULL;
+	mt->size = mt->max = 0;
+}
+// build the hash index for a linear buffer using a counting sort so each bucket is in ascending order
+int zxhashbuild(struct zxhash* hash, unsigned char* buffer, int filesize) {
+	int i, n;
+	n = filesize - MINLENGTH + 1; // number of positions which can start a match
+	if (n < 0) n = 0;
+	hash->bucket = (int*)calloc((1 << HASHBITS) + 1, sizeof(int));
+	hash->first = (int*)malloc((1 << HASHBITS) * sizeof(int));
+	hash->pos = (int*)malloc((n + 1) * sizeof(int));
+	if (hash->bucket == NULL || hash->first == NULL || hash->pos == NULL) {
+		free(hash->bucket);
+		free(hash->first);
+		free(hash->pos);
+		return 8;
+	}
+	for (i = 0; i < n; i++) hash->bucket[zxhashkey(&buffer[i]) + 1]++; // count each bucket
+	for (i = 0; i < 1 << HASHBITS; i++) {
+		hash->bucket[i + 1] += hash->bucket[i]; // turn counts into starts
+		hash->first[i] = hash->bucket[i];
+	}
+	for (i = 0; i < n; i++) hash->pos[hash->first[zxhashkey(&buffer[i])]++] = i; // file in ascending order
+	for (i = 0; i < 1 << HASHBITS; i++) hash->first[i] = hash->bucket[i]; // reset ready for the search
+	hash->matchlen = zxmatchlenpick();
+	hash->compare = 0;
+	return 0;
+}
+// number of bytes the same at the start of a & b, up to max
+int zxmatchlen(const unsigned char* a, const unsigned char* b, int max) {
+	int len;
+	for (len = 0; len < max && a[len] == b[len]; len++);
+	return len;
+}
+#ifdef ZXSIMD
+// position of the lowest set bit, m is never 0
+#ifdef _MSC_VER
+#define zxctz(m) (_BitScanForward(&zxbit, m), (int)zxbit)
+#else
+#define zxctz(m) __builtin_ctz(m)
+#endif
+// compare 16 bytes at a time, the mask has a bit set for each byte that differs. Any bytes left at the end that would
+// take it past max are done one at a time
+ZXTARGET("sse2") int zxmatchlensse2(const unsigned char* a, const unsigned char* b, int max) {
+	int len = 0;
+	unsigned int m;
+#ifdef _MSC_VER
+	unsigned long zxbit;
+#endif
+	for (; len + 16 <= max; len += 16) {
+		m = _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*)(a + len)), _mm_loadu_si128((const __m128i*)(b + len)))) ^ 0xffff;
+		if (m) return len + zxctz(m);
+	}
+	return len + zxmatchlen(a + len, b + len, max - len);
+}
+// same with 32 bytes at a time
+ZXTARGET("avx2") int zxmatchlenavx2(const unsigned char* a, const unsigned char* b, int max) {
+	int len = 0;
+	unsigned int m;
+#ifdef _MSC_VER
+	unsigned long zxbit;
+#endif
+	for (; len + 32 <= max; len += 32) {
+		m = ~(unsigned int)_mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i*)(a + len)), _mm256_loadu_si256((const __m256i*)(b + len))));
+		if (m) return len + zxctz(m);
+	}
+	return len + zxmatchlensse2(a + len, b + len, max - len);
+}
+#endif
+// pick the fastest match length kernel this CPU can run
+int (*zxmatchlenpick(void))(const unsigned char* a, const unsigned char* b, int max) {
+#ifdef ZXSIMD
+#ifdef _MSC_VER
+	int r[4];
+	__cpuid(r, 0);
+	if (r[0] >= 7) {
+		__cpuid(r, 1);
+		if ((r[2] & (1 << 27)) && (r[2] & (1 << 28)) && (_xgetbv(0) & 6) == 6) { // OS saves the AVX registers
+			__cpuidex(r, 7, 0);
+			if (r[1] & (1 << 5)) return zxmatchlenavx2;
+		}
+	}
+	__cpuid(r, 1);
+	if (r[3] & (1 << 26)) return zxmatchlensse2;
+#else
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) return zxmatchlenavx2;
+	if (__builtin_cpu_supports("sse2")) return zxmatchlensse2;
+#endif
+#endif
+	return zxmatchlen;
+}
+// blank cartridge, every sector has its header with the cartridge name & an empty record. The header checksum is the
+// only thing that changes from one sector to the next so the rest is worked out once
+void zxcartblank(struct zxcart* mdr, unsigned char* image, unsigned char* mdrname) {
+	unsigned char* sec;
+	int i, namesum;
+	memset(mdr->blank, 0, sizeof(mdr->blank)); // empty record & data, their checksums are 0
+	mdr->blank[0] = 0x01; // header block
+	memcpy(&mdr->blank[4], mdrname, 10); // cart name 10 length
+	namesum = zxchksum(mdrname, 10);
+	for (i = 0; i < 254; i++) {
+		sec = &image[i * 543]; // sector 254 is position 0, 253 is 543 etc...
+		memcpy(sec, mdr->blank, 543);
+		sec[1] = 0xfe - i; // sector number
+		sec[14] = (0xfe - i + 0x01 + namesum) % 255; // checksum of the first 14bytes
+	}
+	image[254 * 543] = 0x00; // cartridge not write protected
+	memset(mdr->used, 0, sizeof(mdr->used));
+	mdr->image = image;
+	mdr->sector = 0xfe;
+}
+// number of sectors not used
+int zxcartfree(struct zxcart* mdr) {
+	int i, n = 0;
+	for (i = 1; i <= 0xfe; i++) if (!(mdr->used[i >> 3] & (1 << (i & 7)))) n++;
+	return n;
+}
+// cartridge name from the first 10 letters & numbers of name, mdrname is left as spaces after them
+void zxcartname(const char* name, unsigned char* mdrname) {
+	int i = 0, mp = 0;
+	if (name == NULL) return; // left blank
+	do {
+		if ((name[i] >= 48 && name[i] < 58) || (name[i] >= 65 && name[i] < 91) || (name[i] >= 97 && name[i] < 123)) mdrname[mp++] = name[i];
+		i++;
+	} while (i < strlen(name) && mp < 10);
+}
+// number of sectors with a record in a cartridge image
+int zxcartused(const unsigned char* image) {
+	int i, n = 0;
+	for (i = 0; i < 254; i++) if (image[i * 543 + 15]) n++;
+	return n;
+}
+// microdrive checksum of a block, the sum of the bytes mod 255
+int zxchksum(const unsigned char* b, int n) {
+	unsigned long sum = 0;
+	int i;
+	for (i = 0; i < n; i++) sum += b[i];
+	return sum % 255;
+}
 // add data to the microdrive image, needs to be added in sectors 543bytes each with headers etc...
-//   mdrname - name of cart
+//   mdr - cartridge, the file goes from the sector where the last one left off
 //   mdrfile - filename
-//   cart - output cartridge memory pointer
-//   sector - start sectore (where the last one left off)
 //   code - the code to write
 //   len - length of code
 //   start - 
 //   param2 - similar to tape
 //   basic - basic or code
-int appendmdr(unsigned char* mdrname, unsigned char* mdrfile, unsigned char* cart, unsigned char* sector, unsigned char* code, rrrr len, rrrr start, rrrr param2, unsigned char basic) {
-	rrrr chksum, num;
-	unsigned char sequence;
-	int i, j, codepos, numsec, spos, cartpos;
+//   gap - extra sectors after the file before the next one
+// the file is a 9 byte header followed by the code, split into 512 byte records. Each sector keeps its header from
+// the blank cartridge
+int appendmdr(struct zxcart* mdr, unsigned char* mdrfile, unsigned char* code, rrrr len, rrrr start, rrrr param2, unsigned char basic, int gap) {
+	unsigned char* sec, * rec, hdr[9];
+	int n, numsec, sequence, codepos, left;
 	// work out how many sectors needed
 	numsec = ((len.rrrr + 9) / 512) + 1; // +9 for initial header
-	sequence = 0x00;
+	// header in the first record
+	//  (1) 0x00, 0x01, 0x02 or 0x03 - program, number array, character array or code file
+	//  (2,3) 0x00 0x00 - total length
+	//  (4,5) start address of the block (0x05 0x5d for basic 23813)
+	//  (6,7) 0x00 0x00 - total length of program (same as above if basic of 0xff if code) 
+	//  (8,9) 0x00 0x00 - line number if LINE used
+	hdr[0] = basic;
+	hdr[1] = len.r[0];
+	hdr[2] = len.r[1];
+	hdr[3] = start.r[0];
+	hdr[4] = start.r[1];
+	if (basic == 0x00) {
+		hdr[5] = len.r[0];
+		hdr[6] = len.r[1];
+		hdr[7] = param2.r[0];
+		hdr[8] = param2.r[1];
+	}
+	else hdr[5] = hdr[6] = hdr[7] = hdr[8] = 0xff;
+	left = len.rrrr + 9;
 	codepos = 0;
-	// A cartridge file contains 254 'sectors' of 543 bytes each, and a final byte
-	// flag which is non-zero is the cartridge is write protected, so the total 
-	// length is 137923 bytes
-	// each sector writen has a header
-	do {
-		// calculate position based on sector
-		// sector 254 is position 0, 253 is 543 etc...
-		cartpos = (0xfe - *sector) * 543;		
-		// sector header
-		chksum.rrrr = *sector + 0x01;
-		cart[cartpos++] = 0x01; // header block
-		cart[cartpos++] = *sector; // sector number, starts at 254 down to 1
-		cart[cartpos++] = 0x00; // not used
-		cart[cartpos++] = 0x00; // not used
-		for (i = 0; i < 10; i++) {
-			cart[cartpos++] = mdrname[i]; // cart name 10 length
-			chksum.rrrr += mdrname[i]; // build checksum of the first 14bytes
-			chksum.rrrr = chksum.rrrr % 255; // 
-		}
-		cart[cartpos++] = chksum.r[0]; // write checksum
+	for (sequence = 0; sequence < numsec; sequence++) {
+		sec = &mdr->image[(0xfe - mdr->sector) * 543];
+		n = left > 512 ? 512 : left; // bytes in this record
 		// 15 byte file header
 		//	 0x06 - for end of file and data, 0x04 for data if in numerous parts
 		//	 0x00 - sequence number (if file in many parts then this is the number)
 		//	 0x00 0x00 - length of this part 16bit
 		//	 0x00*10 - filename
 		//	 0x00 - header checksum
-		if (sequence == numsec - 1) { // is this the last sector needed?
-			chksum.rrrr = 0x06;
-		}
-		else {
-			chksum.rrrr = 0x04; // part
-		}
-		cart[cartpos++] = chksum.rrrr;
-		cart[cartpos++] = sequence; // data block sequence
-		chksum.rrrr += sequence; // start to build checksum
-		chksum.rrrr = chksum.rrrr % 255;
-		// if length >512 then this is 512 until final part
-		if (len.rrrr > 512) {
-			num.rrrr = 512; // data block length (this sector) lsb
-			cart[cartpos++] = num.r[0];
-			chksum.rrrr += num.r[0];
-			chksum.rrrr = chksum.rrrr % 255;
-			cart[cartpos++] = num.r[1];
-			chksum.rrrr += num.r[1];
-			chksum.rrrr = chksum.rrrr % 255;
-		}
-		else if (numsec > 1) { // final part if length >512
-			cart[cartpos++] = len.r[0]; // data block length lsb
-			chksum.rrrr += len.r[0];
-			chksum.rrrr = chksum.rrrr % 255;
-			cart[cartpos++] = len.r[1];
-			chksum.rrrr += len.r[1];
-			chksum.rrrr = chksum.rrrr % 255;
-		}
-		else { // total length <512 i.e. only one sector
-			len.rrrr += 9; // add 9 for header info
-			cart[cartpos++] = len.r[0];
-			chksum.rrrr += len.r[0];
-			chksum.rrrr = chksum.rrrr % 255;
-			cart[cartpos++] = len.r[1];
-			chksum.rrrr += len.r[1];
-			chksum.rrrr = chksum.rrrr % 255;
-			len.rrrr -= 9;
-		}
-		// filename
-		for (i = 0; i < 10; i++) {
-			cart[cartpos++] = mdrfile[i];
-			chksum.rrrr += mdrfile[i];
-			chksum.rrrr = chksum.rrrr % 255;
-		}
-		cart[cartpos++] = chksum.r[0];
+		rec = &sec[15];
+		rec[0] = sequence == numsec - 1 ? 0x06 : 0x04; // is this the last sector needed?
+		rec[1] = sequence;
+		rec[2] = n & 0xff;
+		rec[3] = n >> 8;
+		memcpy(&rec[4], mdrfile, 10);
+		rec[14] = zxchksum(rec, 14);
 		// data
 		//	512 bytes of data
-		// *note first sequence of data must have the header in the format
-		//  (1) 0x00, 0x01, 0x02 or 0x03 - program, number array, character array or code file
-		//  (2,3) 0x00 0x00 - total length
-		//  (4,5) start address of the block (0x05 0x5d for basic 23813)
-		//  (6,7) 0x00 0x00 - total length of program (same as above if basic of 0xff if code) 
-		//  (8,9) 0x00 0x00 - line number if LINE used
+		rec = &sec[30];
 		if (sequence == 0) {
-			chksum.rrrr = basic;
-			cart[cartpos++] = basic;
-			cart[cartpos++] = len.r[0];
-			chksum.rrrr += len.r[0];
-			chksum.rrrr = chksum.rrrr % 255;
-			cart[cartpos++] = len.r[1];
-			chksum.rrrr += len.r[1];
-			chksum.rrrr = chksum.rrrr % 255;
-			cart[cartpos++] = start.r[0];
-			chksum.rrrr += start.r[0];
-			chksum.rrrr = chksum.rrrr % 255;
-			cart[cartpos++] = start.r[1];
-			chksum.rrrr += start.r[1];
-			chksum.rrrr = chksum.rrrr % 255;
-			// if basic
-			if (basic == 0x00) {
-				cart[cartpos++] = len.r[0];
-				chksum.rrrr += len.r[0];
-				chksum.rrrr = chksum.rrrr % 255;
-				cart[cartpos++] = len.r[1];
-				chksum.rrrr += len.r[1];
-				chksum.rrrr = chksum.rrrr % 255;
-				cart[cartpos++] = param2.r[0];
-				chksum.rrrr += param2.r[0];
-				chksum.rrrr = chksum.rrrr % 255;
-				cart[cartpos++] = param2.r[1];
-				chksum.rrrr += param2.r[1];
-				chksum.rrrr = chksum.rrrr % 255;
-			}
-			else {
-				cart[cartpos++] = 0xff;
-				chksum.rrrr += 0xff;
-				chksum.rrrr = chksum.rrrr % 255;
-				cart[cartpos++] = 0xff;
-				chksum.rrrr += 0xff;
-				chksum.rrrr = chksum.rrrr % 255;
-				cart[cartpos++] = 0xff;
-				chksum.rrrr += 0xff;
-				chksum.rrrr = chksum.rrrr % 255;
-				cart[cartpos++] = 0xff;
-				chksum.rrrr += 0xff;
-				chksum.rrrr = chksum.rrrr % 255;
-			}
-			spos = 39;
+			memcpy(rec, hdr, 9);
+			memcpy(&rec[9], code, n - 9);
+			codepos = n - 9;
 		}
 		else {
-			chksum.rrrr = 0;
-			spos = 30; // to cover the headers
-		}
-		// copy code
-		if (len.rrrr > 512) {
-			j = 512;
-			if (sequence == 0) j -= 9;
-			for (i = 0; i < j; i++) {
-				cart[cartpos++] = code[codepos];
-				chksum.rrrr += code[codepos++];
-				chksum.rrrr = chksum.rrrr % 255;
-				spos++;
-			}
+			memcpy(rec, &code[codepos], n);
+			codepos += n;
 		}
-		else {
-			for (i = 0; i < len.rrrr; i++) {
-				cart[cartpos++] = code[codepos];
-				chksum.rrrr += code[codepos++];
-				chksum.rrrr = chksum.rrrr % 255;
-				spos++;
-			}
-		}
-		// pading on last sequence
-		while (spos++ < 542) cart[cartpos++] = 0x00;
-		cart[cartpos++] = chksum.r[0];
-		if (sequence == 0) len.rrrr -= 503; // remove 9 for header
-		else len.rrrr -= 512;
-		//
-		if (fndsector(sector, cart, 2) > 0) error(11);
-	} while (++sequence < numsec);
+		memset(&rec[n], 0, 512 - n); // pading on last sequence
+		rec[512] = zxchksum(rec, n);
+		left -= n;
+		mdr->used[mdr->sector >> 3] |= 1 << (mdr->sector & 7);
+		if (fndsector(mdr, zxgap(0.0)) > 0) return 11;
+	}
 	// add extra blank sectors to give time for basic to process before loading next
-	if (fndsector(sector, cart, 2) > 0) error(11);
+	if (fndsector(mdr, gap) > 0) return 11;
 	return 0;
 }
-int fndsector(unsigned char* sector, unsigned char* cart, int gap) {
+// move on to the next free sector at least gap sectors on
+int fndsector(struct zxcart* mdr, int gap) {
 	int count = 0;
 	do {
-		if (--(*sector) == 0x00) *sector = 0xfe;
+		if (--mdr->sector == 0x00) mdr->sector = 0xfe;
 		if (++count == 254) return count; // how many sectors checked if=254 then no space on cartridge
 		if (gap > 0) gap--;
-	} while(gap||cart[(0xfe - *sector) * 543 + 15]); //if gap>0 OR not a blank sector
+	} while (gap || (mdr->used[mdr->sector >> 3] & (1 << (mdr->sector & 7)))); //if gap>0 OR not a blank sector
 	return 0;
 }
+// gather a file from the cartridge into out, without the 9 byte header. pos gets the position of each record in the
+// image by sequence & len the length of the file. Returns the number of records or 0 if it isn't all there
+int zxcartread(const unsigned char* image, const unsigned char* mdrfile, unsigned char* out, int max, int* pos, int* len) {
+	const unsigned char* rec;
+	int i, n, nrec = 0, at, size = 0;
+	for (i = 0; i < 254; i++) pos[i] = -1;
+	for (i = 0; i < 254; i++) {
+		rec = &image[i * 543 + 15];
+		if (rec[0] == 0x00 || memcmp(&rec[4], mdrfile, 10) != 0) continue; // blank or another file
+		pos[rec[1]] = i;
+		if (rec[0] & 0x02) nrec = rec[1] + 1; // end of file is the last record
+	}
+	if (nrec == 0) return 0;
+	for (i = 0, at = -9; i < nrec; i++) {
+		if (pos[i] < 0) return 0; // missing record
+		rec = &image[pos[i] * 543 + 15];
+		n = rec[2] + rec[3] * 256;
+		if (n > 512) return 0;
+		if (i == 0) size = rec[15 + 1] + rec[15 + 2] * 256; // header
+		for (n--; n >= 0; n--) if (at + n >= 0 && at + n < max) out[at + n] = rec[15 + n];
+		at += rec[2] + rec[3] * 256;
+	}
+	if (size > at) return 0;
+	*len = size;
+	return nrec;
+}
+// read a cartridge back the way the Spectrum does after LOADing loader & running the game's launcher. Every sector's
+// checksums are checked, then each file the BASIC loads is put together & unpacked into ram, 0x4000 to 0xffff then
+// pages 1, 3, 4, 6 & 7 as z80onmdr() lays them out. Bytes the launcher keeps for itself, its stack code & any screen
+// it borrows, are set in skip (0x4000 on). Returns 0 or 17 if anything doesn't check out
+int zxcartload(const unsigned char* image, const unsigned char* loader, unsigned char* ram, unsigned char* skip) {
+	static const int pageram[8] = { 32768, 49152, 16384, 65536, 81920, 0, 98304, 114688 }; // where each page goes
+	const unsigned char* sec;
+	unsigned char mdrfile[] = "          ", list[10], tab[16], * data, * igp;
+	int pos[254], len, nfile, grow = 0, f, i, k, page, start, adder, cpyf, from, delta, hl, clr, ntab = 0, err = 17;
+	for (i = 0; i < 254; i++) { // sector header, record header & data checksums
+		sec = &image[i * 543];
+		if (sec[14] != zxchksum(sec, 14) || sec[29] != zxchksum(&sec[15], 14) || sec[542] != zxchksum(&sec[30], 512)) return 17;
+	}
+	if ((data = (unsigned char*)malloc(65536 * sizeof(unsigned char))) == NULL) return 17;
+	// the BASIC, files listed the same as z80onmdrgametime() finds them
+	if (zxcartread(image, loader, data, 65536, pos, &len) == 0 || len < mdrbln_len || data[0] || data[1] || data[4] != 0xfd) goto done;
+	if (data[mdrbln_for] == 0xf1) {
+		for (nfile = 0; nfile < 8 && data[mdrbln_for + 5 + nfile] != '"'; nfile++) list[nfile] = data[mdrbln_for + 5 + nfile];
+		grow = nfile + 9;
+	}
+	else for (nfile = 0; nfile < 6 && nfile <= data[mdrbln_to] - '0'; nfile++) list[nfile] = '0' + nfile;
+	list[nfile++] = data[mdrbln_main + grow];
+	adder = data[mdrbln_cpyx + grow] + data[mdrbln_cpyx + grow + 1] * 256; // stage 1 copies these bytes
+	cpyf = data[mdrbln_cpyf + grow] + data[mdrbln_cpyf + grow + 1] * 256;
+	from = data[mdrbln_jp + grow] + data[mdrbln_jp + grow + 1] * 256 == 16384 ? 23296 : cpyf + adder; // old launcher in screen
+	for (f = 0; f < nfile; f++) {
+		mdrfile[0] = list[f];
+		if (zxcartread(image, mdrfile, data, 65536, pos, &len) == 0) goto done;
+		sec = &image[pos[0] * 543 + 30]; // 9 byte header
+		start = sec[3] + sec[4] * 256;
+		if (f == nfile - 1) break; // main
+		if (f == 0) { // screen after its loader
+			if (len <= scrload_len || zxunsc(&data[scrload_len], len - scrload_len, ram, 6912, 1) != 6912) goto done;
+			continue;
+		}
+		if (start == 32179 && data[0] == 0x21) { // patch after the patcher (ld hl), count, port, address & bytes for each
+			for (i = patcher_len; i < len && data[i]; i += data[i] + 4) {
+				if (i + 4 + data[i] > len) goto done;
+				for (k = 0; k < data[i]; k++) zxcartpoke(ram, data[i + 1], data[i + 2] + data[i + 3] * 256 + k, data[i + 4 + k]);
+			}
+			continue;
+		}
+		k = 1; // later pages have only the page number before the data
+		page = data[0];
+		if (start != 32255) { // 1st page, pageops & its table if some pages aren't loaded then the unpacker
+			k = 0;
+			if (data[0] != 0xf3) {
+				for (k = pageops_len; k < len && k < pageops_len + 15 && data[k]; k += 3);
+				ntab = k - pageops_len;
+				memcpy(tab, &data[pageops_len], ntab);
+				k++;
+			}
+			k += unpack_len;
+			if (k > len) goto done;
+			page = data[k - 1];
+		}
+		if ((page & 0xf8) != 0x10 || page == 0x12 || page == 0x15 || page == 0x10) goto done;
+		if (zxunsc(&data[k], len - k, &ram[pageram[page & 7]], 16384, 0) != 16384) goto done;
+	}
+	for (i = 0; i < ntab; i += 3) { // pageops fills or copies the rest once the last page is in, 0xff copies the same again
+		if (tab[i + 1] == 0x00) memset(&ram[pageram[tab[i] & 7]], tab[i + 2], 16384);
+		else {
+			if (tab[i + 1] != 0xff) page = tab[i + 1];
+			memcpy(&ram[pageram[tab[i] & 7]], &ram[pageram[page & 7]], 16384);
+		}
+	}
+	// main, stage 1 copies the launcher to cpyf & it unpacks the rest after it
+	if (len < adder || cpyf < 16384 || cpyf + adder > 65536) goto done;
+	memcpy(&ram[cpyf - 16384], data, adder);
+	i = zxunsc(&data[adder], len - adder, &ram[from - 16384], 65536 - from, 0);
+	if (from == 23296) { // old launcher in screen, puts the last bytes back from its copy
+		delta = ram[launch_scr_lcs];
+		if (i != 65536 - from - delta) goto done;
+		memcpy(&ram[49152 - delta], &ram[launch_scr_delta], delta);
+		memset(skip, 1, adder);
+	}
+	else { // the in gap part puts back the last bytes & the printer buffer then clears itself below the stack code
+		hl = ram[from - 16384 - noc_launchprt_len + noc_launchprt_jp] + ram[from - 16384 - noc_launchprt_len + noc_launchprt_jp + 1] * 256;
+		if (hl < 16384 || hl > 65536 - noc_launchigp_begin) goto done;
+		igp = &ram[hl - 16384];
+		delta = igp[noc_launchigp_lcs];
+		hl = igp[noc_launchigp_bdata] + igp[noc_launchigp_bdata + 1] * 256;
+		if (i != 65536 - from - delta || hl < 16384 || hl + delta + noc_launchprt_len > 65536) goto done;
+		memmove(&ram[49152 - delta], &ram[hl - 16384], delta);
+		memmove(&ram[23296 - 16384], &ram[hl + delta - 16384], noc_launchprt_len);
+		clr = igp[noc_launchigp_clr] ? igp[noc_launchigp_clr] : 256;
+		k = igp[noc_launchigp_chr];
+		start = igp[noc_launchigp_jp] + igp[noc_launchigp_jp + 1] * 256; // stack code, its last 2 bytes are under sp
+		i = igp[noc_launchigp_rd] + igp[noc_launchigp_rd + 1] * 256;
+		hl += delta + noc_launchprt_len;
+		if (hl - clr < 16384 || start < 16384 || start + noc_launchstk_af > 65536 || i < 16384 || i + 2 > 65536) goto done;
+		memset(&ram[hl - clr - 16384], k, clr);
+		for (f = hl - clr; f < hl && f < 23296; f++) skip[f - 16384] = 1; // screen attributes it borrowed
+		memset(&skip[start - 16384], 1, noc_launchstk_af);
+		memset(&skip[i - 16384], 1, 2);
+	}
+	err = 0;
+done:
+	free(data);
+	return err;
+}
+// write a byte as the Spectrum sees it with port 0x7ffd set to port
+void zxcartpoke(unsigned char* ram, int port, int addr, unsigned char b) {
+	static const int pageram[8] = { 32768, 49152, 16384, 65536, 81920, 0, 98304, 114688 };
+	if (addr >= 0xc000) ram[pageram[port & 7] + addr - 0xc000] = b;
+	else if (addr >= 0x4000) ram[addr - 0x4000] = b;
+}
+// read the cartridge back & check it against main, the snapshot as z80onmdr() decodes it. Returns 0 or 17
+int zxverify(const unsigned char* image, const unsigned char* loader, const unsigned char* main, int otek) {
+	unsigned char* ram;
+	int i, err;
+	if ((ram = (unsigned char*)calloc(131072 + 49152, sizeof(unsigned char))) == NULL) return 17;
+	err = zxcartload(image, loader, ram, &ram[131072]);
+	for (i = 0; i < 49152 && err == 0; i++) if (ram[i] != main[i] && !ram[131072 + i]) err = 17;
+	if (err == 0 && otek && memcmp(&ram[49152], &main[49152], 5 * 16384)) err = 17;
+	free(ram);
+	return err;
+}
+// where the tape is once the records at pos have been read in order, starting t seconds into the loop
+double zxloadfile(int* pos, int nrec, double t) {
+	double sec = ZXMDRLOOP / 254.0, wait;
+	int i;
+	for (i = 0; i < nrec; i++) {
+		wait = t / sec;
+		wait = pos[i] - (wait - 254.0 * (long)(wait / 254.0)); // sectors until the record comes round
+		if (wait < 0.0) wait += 254.0;
+		t += (wait + 1.0) * sec + ZXMDRPROC; // read it then store it
+	}
+	return t;
+}
+// estimated seconds from RUN to the game starting for a cartridge made by z80onmdr(), -1 if it isn't one. Each file
+// is LOADed from BASIC & its records are read in order as the tape goes round, then the stage that uses it runs with
+// the motor off. The tape could be anywhere when RUN is typed so it is the average over every start sector
+double z80onmdrtime(const unsigned char* cart) {
+	return z80onmdrgametime(cart, 0);
+}
+// estimated seconds from choosing game 1 to 9 on the menu of a cartridge made by z80onmdrpack() to it starting, or for
+// game 0 from RUN on any other. -1 if there isn't one
+double z80onmdrgametime(const unsigned char* cart, int game) {
+	unsigned char mdrfile[] = "run       ", * data, list[10];
+	int pos[10][254], nrec[10], len[10], nfile, f, h, adder = 0, grow = 0, page = 0;
+	double busy[10], t, tape, total = 0.0, ops = 0.0;
+	if ((data = (unsigned char*)malloc(65536 * sizeof(unsigned char))) == NULL) return -1.0;
+	// the BASIC has the files to load, a FOR loop for one snapshot or a list of them if there are several
+	if (game) mdrfile[3] = '0' + game;
+	nrec[0] = zxcartread(cart, mdrfile, data, 65536, pos[0], &len[0]);
+	busy[0] = ZXMDRBASIC; // the next LOAD
+	if (nrec[0] == 0 || len[0] < mdrbln_len || data[0] || data[1] || data[4] != 0xfd) { // line 0 CLEAR, not the menu
+		free(data);
+		return -1.0;
+	}
+	if (data[mdrbln_for] == 0xf1) { // let n$="..."
+		for (nfile = 0; nfile < 8 && data[mdrbln_for + 5 + nfile] != '"'; nfile++) list[nfile] = data[mdrbln_for + 5 + nfile];
+		grow = nfile + 9; // let n$="...": & the longer load
+	}
+	else for (nfile = 0; nfile < 6 && nfile <= data[mdrbln_to] - '0'; nfile++) list[nfile] = '0' + nfile;
+	list[nfile++] = data[mdrbln_main + grow];
+	adder = data[mdrbln_cpyx + grow] + data[mdrbln_cpyx + grow + 1] * 256; // copied by BASIC
+	for (f = 1; f <= nfile; f++) {
+		mdrfile[0] = list[f - 1];
+		mdrfile[1] = mdrfile[2] = mdrfile[3] = ' ';
+		nrec[f] = zxcartread(cart, mdrfile, data, 65536, pos[f], &len[f]);
+		busy[f] = ZXMDRBASIC;
+		if (nrec[f] == 0) break;
+		if (f == 1 && len[f] > scrload_len) busy[f] += zxunpacktime(&data[scrload_len], len[f] - scrload_len, 1);
+		else if (f == nfile && len[f] > adder) busy[f] += zxunpacktime(&data[adder], len[f] - adder, 0) + 21.0 * adder / ZXTSTATES; // launcher first
+		else if (data[0] == 0x21 && len[f] > patcher_len) busy[f] += zxpatchtime(&data[patcher_len], len[f] - patcher_len); // patcher
+		else if (page == 0 && len[f] > unpack_len) { // 1st page has the unpacker, after pageops if some pages aren't loaded
+			h = 0;
+			if (data[0] != 0xf3 && len[f] > pageops_len + 16) {
+				ops = zxopstime(&data[pageops_len]);
+				for (h = pageops_len; h < pageops_len + 15 && data[h]; h += 3);
+				h++;
+			}
+			if (len[f] > h + unpack_len) busy[f] += zxunpacktime(&data[h + unpack_len], len[f] - h - unpack_len, 0);
+			page = f;
+		}
+		else if (page && len[f] > 1) { // rest only the page number
+			busy[f] += zxunpacktime(&data[1], len[f] - 1, 0);
+			page = f;
+		}
+	}
+	free(data);
+	if (f <= nfile) return -1.0; // a file is missing
+	busy[page] += ops; // pageops runs after the last page
+	for (h = 0; h < 254; h++) {
+		tape = h * ZXMDRLOOP / 254.0; // how far round the tape is
+		for (f = 0, t = 0.0; f <= nfile; f++) {
+			t -= tape;
+			tape = zxloadfile(pos[f], nrec[f], tape);
+			t += tape + busy[f];
+			tape += zxcoast(busy[f]);
+		}
+		total += t;
+	}
+	return total / 254.0;
+}
+// seconds the Spectrum takes to unpack a compressed block, from the T-states each token takes in the unpacker
+double zxunpacktime(const unsigned char* comp, unsigned long len, int screen) {
+	const struct zxcost* k = screen ? &zxcostscreen : &zxcostlinear;
+	struct zxtok tok;
+	memset(&tok, 0, sizeof(tok));
+	zxtokens(comp, len, &tok);
+	return ((double)k->lit * tok.lit + (double)k->litbyte * tok.litbytes + (double)k->match * tok.match +
+		(double)k->longmatch * tok.longmatch + (double)k->matchbyte * tok.matchbytes) / ZXTSTATES;
+}
+// seconds pageops takes for its table, 21 T-states for each byte an ldir moves
+double zxopstime(const unsigned char* tab) {
+	double t = 0.0;
+	int i;
+	for (i = 0; i < 5 && tab[i * 3]; i++) t += (tab[i * 3 + 1] == 0x00 || tab[i * 3 + 1] == 0xff ? 1.0 : 2.0) * 16384.0 * 21.0;
+	return t / ZXTSTATES;
+}
+// patch records for the bytes of to that differ from from, n bytes at addr in the page given by port. Up to 4 bytes
+// that match are taken in with the ones either side as a new record would be as big. Returns the bytes written, or
+// -1 if that would be more than max
+int zxpatch(const unsigned char* from, const unsigned char* to, int n, int addr, int port, unsigned char* out, int max) {
+	int i = 0, j, end, len = 0;
+	while (i < n) {
+		if (from[i] == to[i]) {
+			i++;
+			continue;
+		}
+		for (j = end = i; j < n && j - i < 255 && j - end <= 4; j++) if (from[j] != to[j]) end = j;
+		j = end - i + 1;
+		if (len + 4 + j > max) return -1;
+		out[len++] = j;
+		out[len++] = port;
+		out[len++] = (addr + i) & 0xff;
+		out[len++] = (addr + i) >> 8;
+		memcpy(&out[len], &to[i], j);
+		len += j;
+		i = end + 1;
+	}
+	return len;
+}
+// seconds patcher takes for the records in len bytes, 21 T-states for each byte an ldir moves
+double zxpatchtime(const unsigned char* rec, int len) {
+	double t = 0.0;
+	int i;
+	for (i = 0; i < len && rec[i]; i += rec[i] + 4) t += rec[i] * 21.0 + 100.0;
+	return t / ZXTSTATES;
+}
+// BASIC for one of several snapshots on a cartridge, the FOR loop goes through the files in n$ rather than 0 to 5 so
+// files can be shared. The line gets longer so the addresses that point to the machine code after it are moved up to
+// match. Returns the length
+int zxsetbasic(const unsigned char* mdrbln, const unsigned char* list, int nlist, unsigned char mainname, unsigned char* out) {
+	static const unsigned char loop[] = {	0xeb,0x69,0x3d,0xb0,0x22,0x31,0x22,0xcc,0xb1,0x6e,0x24,0x3a,				// for i=val "1" to len n$:
+											0xef,0x2a,0x22,0x6d,0x22,0x3b,0x64,0x3b,0x6e,0x24,0x28,0x69,0x29,0xaf };	// load *"m";d;n$(i) code
+	static const int fix[] = { mdrbln_usr0, mdrbln_usr1, mdrbln_sp };
+	int i, n, grow, addr, v;
+	memcpy(out, mdrbln, mdrbln_for);
+	n = mdrbln_for;
+	out[n++] = 0xf1; // let n$="..":
+	out[n++] = 'n';
+	out[n++] = '$';
+	out[n++] = '=';
+	out[n++] = '"';
+	memcpy(&out[n], list, nlist);
+	n += nlist;
+	out[n++] = '"';
+	out[n++] = ':';
+	memcpy(&out[n], loop, sizeof(loop));
+	n += sizeof(loop);
+	grow = n - mdrbln_run;
+	memcpy(&out[n], &mdrbln[mdrbln_run], mdrbln_len - mdrbln_run);
+	n += mdrbln_len - mdrbln_run;
+	out[2] += grow; // line length
+	out[mdrbln_main + grow] = mainname;
+	for (i = 0; i < 3; i++) { // randomize usr & the stack pointing into the machine code
+		addr = fix[i] < mdrbln_for ? fix[i] : fix[i] + grow;
+		v = out[addr] + out[addr + 1] * 256 + grow;
+		out[addr] = v & 0xff;
+		out[addr + 1] = v >> 8;
+	}
+	return n;
+}
+// menu BASIC for z80onmdrpack(), line 10 prints each title with the key for it, 20 waits for one of the keys & 30
+// loads that game's BASIC from the same drive. Titles are cut to fit a line & quotes swapped. Returns the length
+int zxmenubasic(const char** title, int n, unsigned char* out) {
+	static const unsigned char wait[] = {	0x00,0x14,0x1c,0x00,0xf1,0x6b,0x24,0x3d,0xa6,0x3a,								// 20 let k$=inkey$:
+											0xfa,0x6b,0x24,0x3c,0x22,0x31,0x22,0xc5,0x6b,0x24,0x3e,0x22,0x31,0x22,			// if k$<"1" or k$>"n"
+											0xcb,0xec,0xb0,0x22,0x32,0x30,0x22,0x0d,										// then go to val "20"
+											0x00,0x1e,0x19,0x00,0xef,0x2a,0x22,0x6d,0x22,0x3b,								// 30 load *"m";
+											0xbe,0xb0,0x22,0x32,0x33,0x37,0x36,0x36,0x22,0x3b,								// peek val "23766";
+											0x22,0x72,0x75,0x6e,0x22,0x2b,0x6b,0x24,0x0d };									// "run"+k$
+#define menu_wait_key 22 // last key
+	int i, j, n0;
+	out[0] = 0x00; // 10 cls
+	out[1] = 0x0a;
+	out[4] = 0xfb;
+	n0 = 5;
+	for (i = 0; i < n; i++) {
+		out[n0++] = ':'; // :print "1 title"
+		out[n0++] = 0xf5;
+		out[n0++] = '"';
+		out[n0++] = '1' + i;
+		out[n0++] = ' ';
+		for (j = 0; title[i][j] && j < 28; j++) out[n0++] = title[i][j] == '"' ? '\'' : title[i][j] < 32 || title[i][j] > 126 ? '?' : title[i][j];
+		out[n0++] = '"';
+	}
+	out[n0++] = 0x0d;
+	out[2] = (n0 - 4) & 0xff;
+	out[3] = (n0 - 4) >> 8;
+	memcpy(&out[n0], wait, sizeof(wait));
+	out[n0 + menu_wait_key] = '0' + n;
+#undef menu_wait_key
+	return n0 + sizeof(wait);
+}
+// how far the tape runs on, in seconds at full speed, while the Spectrum is busy for busy seconds with the motor off.
+// It slows down evenly until it stops
+double zxcoast(double busy) {
+	if (busy > ZXMDRSTOP) busy = ZXMDRSTOP;
+	return busy - busy * busy / (2.0 * ZXMDRSTOP);
+}
+// sectors to move on after a sector so the next one is reached just after busy seconds of work, 2 for the next
+// sector of the same file
+int zxgap(double busy) {
+	double sec = ZXMDRLOOP / 254.0;
+	return 2 + (int)((ZXMDRPROC + zxcoast(busy)) / sec);
+}
 // check compression to ensure it can be decompressed within Spectrum memory
 int decompressf(unsigned char* comp, int compsize, int mainsize) {
 	unsigned char* hl;
@@ -1352,6 +2738,732 @@ int decompressf(unsigned char* comp, int compsize, int mainsize) {
 	if (maxdelta) return maxdelta;
 	return 0;
 }
+// unpack a zxsc block into out the same as the Spectrum unpackers, a screen goes back into screen layout. Returns the
+// bytes unpacked or -1 if the block is cut short, points outside what has been unpacked or overflows max
+int zxunsc(const unsigned char* comp, int len, unsigned char* out, int max, int screen) {
+	unsigned char scrlinear[6912], * lin = screen ? scrlinear : out;
+	unsigned short back[6912]; // screen address to position in the screen order
+	int i = 0, n = 0, c, l, o;
+	if (screen) {
+		if (max > 6912) max = 6912;
+		for (c = 0; c < 6912; c++) back[zxorder[c]] = c;
+	}
+	while (i < len && comp[i] != 0xff) {
+		c = comp[i++];
+		if (c < 0x20) { // literals
+			l = c + 1;
+			if (i + l > len || n + l > max) return -1;
+			memcpy(&lin[n], &comp[i], l);
+			i += l;
+			n += l;
+			continue;
+		}
+		l = c >> 5;
+		if (l == 7) {
+			if (i >= len) return -1;
+			l += comp[i++];
+		}
+		l += 2;
+		if (i >= len) return -1;
+		o = (c & 0x1f) << 8 | comp[i++];
+		if (screen) o = o < 6912 ? back[o] : n; // screen address of the match
+		else o = n - o - 1; // offset
+		if (o < 0 || o >= n || n + l > max) return -1;
+		while (l--) lin[n++] = lin[o++]; // can overlap
+	}
+	if (i >= len) return -1; // no end marker
+	if (screen) for (i = 0; i < n; i++) out[zxorder[i]] = scrlinear[i];
+	return n;
+}
+// index each run of the same byte between from & to, returns the number of runs
+int zxrunindex(unsigned char* mem, int from, int to, struct zxrun* run) {
+	int i, nrun = 0;
+	for (i = from; i < to; i++) {
+		if (nrun && run[nrun - 1].byte == mem[i] && run[nrun - 1].start + run[nrun - 1].len == i) {
+			run[nrun - 1].len++; // carry on the run
+		}
+		else {
+			run[nrun].start = i;
+			run[nrun].len = 1;
+			run[nrun++].byte = mem[i];
+		}
+	}
+	return nrun;
+}
+// find the longest usable gap, returns its length and sets its position & byte. A gap can start above the stack or
+// be cut short so it ends stacklen+1 bytes below it. Ties go to the lowest byte then the lowest position, rank 1 gives
+// the gap that comes next in that order & so on
+int zxrungap(struct zxrun* run, int nrun, int stack, int stacklen, int rank, int* gappos, int* gapchr) {
+	int i, len, maxgap, lastgap = 0x7fffffff, lastchr = -1, lastpos = -1;
+	do {
+		maxgap = 0;
+		*gappos = *gapchr = 0;
+		for (i = 0; i < nrun; i++) {
+			if (run[i].start - 1 > stack) { // start of gap > stack then ok
+				len = run[i].len;
+			}
+			else { // end of gap < stack - stacklen then ok
+				len = stack - stacklen - run[i].start;
+				if (len > run[i].len) len = run[i].len;
+			}
+			if (len > lastgap || (len == lastgap && (run[i].byte < lastchr || (run[i].byte == lastchr && run[i].start <= lastpos)))) continue; // ranked already
+			if (len > maxgap || (len == maxgap && len > 0 && run[i].byte < *gapchr)) {
+				maxgap = len;
+				*gappos = run[i].start;
+				*gapchr = run[i].byte;
+			}
+		}
+		lastgap = maxgap;
+		lastchr = *gapchr;
+		lastpos = *gappos;
+	} while (rank-- > 0 && maxgap > 0);
+	return maxgap;
+}
+// put the launcher in & compress the main block, going round until delta covers the overlap at the end. Only the
+// longest gap (rank 0) falls back to the screen attributes when it is too small, any other rank just fails
+int zxmainfit(struct zxmainjob* m) {
+	int i, dgap, maxgap, maxpos, attr[256], attrb, cached;
+	unsigned char* main48k = m->main48k;
+	const unsigned char* noc_launchstk = m->stk;
+	rrrr start;
+	double t;
+	m->igppos = 0;
+	m->chr = 0;
+	m->stshift = 0;
+	m->cmsize = 0;
+	m->err = 0;
+	do {
+		for (i = 0; i < 49152; i++) main48k[i] = m->main[i]; // create copy of 1st 48k for manipulation
+		// new byte series scan
+		if (m->oldl == 0) {
+			m->igppos = 0;
+			// find maximum gap
+			t = zxclock();
+			maxgap = zxrungap(m->run, m->nrun, m->stackpos - 16384, noc_launchstk_len, m->rank, &maxpos, &m->chr);
+			m->st->gap += zxclock() - t;
+			if (maxgap > (noc_launchigp_len + m->delta - 3)) {
+				m->igppos = maxpos; // start of in gap 
+			}
+			else if (m->rank) return m->err = 9;
+			else {	// cannot find large enough gap so use screen attr
+				m->igppos = 6912 - (noc_launchigp_len + m->delta - 3);
+				for (i = 0; i <= 0xff; i++) attr[i] = 0;
+				for (i = m->igppos; i < 6912; i++) attr[main48k[i]]++; // count each attr
+				attrb = 0;
+				for (i = 0x00; i <= 0xff; i++) {	//find most common attr, highest wins a tie
+					if (attr[i] >= attrb) {
+						attrb = attr[i];
+						m->chr = i;
+					}
+				}
+			}
+			// is pc in the way?
+			if (m->stkpos <= (noc_launchstk[noc_launchstk_jp + 1] * 256 + noc_launchstk[noc_launchstk_jp]) &&
+					m->stkpos + noc_launchstk_len > (noc_launchstk[noc_launchstk_jp + 1] * 256 + noc_launchstk[noc_launchstk_jp])) {
+				m->stshift = m->stackpos - (noc_launchstk[noc_launchstk_jp + 1] * 256 + noc_launchstk[noc_launchstk_jp]); // stack - pc
+				if (m->stshift <= 2) return m->err = 13;
+				m->stshift = noc_launchstk_af; // shift equivalent of 32bytes below where is was (4bytes still remain under the stack)
+			}
+			start.rrrr = m->igppos + 16384;
+			m->prt[noc_launchprt_jp] = start.r[0];
+			m->prt[noc_launchprt_jp + 1] = start.r[1]; // jump into gap
+			start.rrrr = m->igppos + noc_launchigp_begin + 16384;
+			m->igp[noc_launchigp_bdata] = start.r[0];
+			m->igp[noc_launchigp_bdata + 1] = start.r[1]; // bdata start
+			m->igp[noc_launchigp_lcs] = m->delta;
+			if (noc_launchigp_len + m->delta - 3 == 256) {
+				m->igp[noc_launchigp_clr] = 0x00;
+			}
+			else {
+				m->igp[noc_launchigp_clr] = noc_launchigp_len + m->delta - 3; // size of ingap clear
+			}
+			m->igp[noc_launchigp_chr] = m->chr; // set the erase char in stack code
+			start.rrrr = m->stkpos - m->stshift;
+			m->igp[noc_launchigp_jp] = start.r[0];
+			m->igp[noc_launchigp_jp + 1] = start.r[1]; // jump to stack code - adjust - shift
+			// copy stack routine under stack, split version if shift
+			if (m->stshift) {
+				for (i = 0; i < noc_launchstk_len - 2; i++) main48k[m->stkpos - 16384 + i - m->stshift] = noc_launchstk[i];
+				//final 2bytes just below new code
+				for (i = 0; i < 2; i++) main48k[m->stackpos - 16384 + i - 2] = noc_launchstk[noc_launchstk_len - 2 + i];
+			}
+			else {
+				for (i = 0; i < noc_launchstk_len; i++) main48k[m->stkpos - 16384 + i] = noc_launchstk[i]; // standard copy
+			}
+			// if ingap not in screen attr, this is done after so as to not effect the screen compression
+			if (m->igppos >= 6912) {
+				// copy prtbuf to code
+				for (i = 0; i < noc_launchprt_len; i++) main48k[m->igppos + noc_launchigp_begin + m->delta + i] = main48k[6912 + i];
+				// copy delta to code
+				for (i = 0; i < m->delta; i++) main48k[m->igppos + noc_launchigp_begin + i] = main48k[49152 - m->delta + i];
+				// copy in compression routine into main
+				for (i = 0; i < noc_launchigp_begin; i++) main48k[m->igppos + i] = m->igp[i];
+			}
+		}
+		t = zxclock();
+		m->cmsize = zxsccache(m->cache, &main48k[m->startpos], &m->comp[8704], m->mainsize - m->delta, 0, m->mt, m->parse, m->level, &cached); // upto the full size - delta
+		zxstatcall(m->st, "main", zxclock() - t, m->mainsize - m->delta, m->cmsize, cached);
+		m->st->ndelta++;
+		if (m->cmsize == 0) return m->err = 8;
+		dgap = decompressf(&m->comp[8704], m->cmsize, m->mainsize);
+		m->delta += dgap;
+		if (m->delta > B_GAP) return m->err = 9;
+	} while (dgap > 0);
+	// launcher bytes added in front
+	if (m->oldl) m->adder = launch_scr_len + m->delta - 3; // add launcher + delta
+	else {
+		m->adder = noc_launchprt_len; // just add prtbuf launcher
+		if (m->igppos < 6912) m->adder += noc_launchprt_len + m->delta + noc_launchigp_begin; // if ingap in screen 
+	}
+	return 0;
+}
+// one -k go at the main block on the pool
+void zxmainrun(struct zxpool* pool, void* arg) {
+	struct zxmainjob* m = (struct zxmainjob*)arg;
+	(void)pool;
+	if (m->err == 0) zxmainfit(m);
+}
+// take jobs off the pool until there are none left
+#ifdef _WIN32
+DWORD WINAPI zxworker(LPVOID arg) {
+#else
+void* zxworker(void* arg) {
+#endif
+	struct zxpool* pool = (struct zxpool*)arg;
+	void* job;
+	for (;;) {
+		zxpoollock(pool);
+		job = NULL;
+		if (pool->next < pool->njob) job = (char*)pool->job + pool->size * pool->next++;
+		zxpoolunlock(pool);
+		if (job == NULL) break;
+		pool->run(pool, job);
+	}
+	return 0;
+}
+// start nthread workers on the jobs, with none the jobs are all done by zxpoolfinish
+void zxpoolstart(struct zxpool* pool, void* job, int size, int njob, int nthread, void (*run)(struct zxpool* pool, void* job)) {
+	pool->job = job;
+	pool->size = size;
+	pool->run = run;
+	pool->njob = njob;
+	pool->next = 0;
+	pool->nthread = 0;
+	if (nthread > njob) nthread = njob; // no point having idle threads
+	if (nthread > MAXTHREADS) nthread = MAXTHREADS;
+#ifdef _WIN32
+	InitializeCriticalSection(&pool->lock);
+	while (pool->nthread < nthread) {
+		if ((pool->thread[pool->nthread] = CreateThread(NULL, 0, zxworker, pool, 0, NULL)) == NULL) break;
+		pool->nthread++;
+	}
+#else
+	pthread_mutex_init(&pool->lock, NULL);
+	while (pool->nthread < nthread) {
+		if (pthread_create(&pool->thread[pool->nthread], NULL, zxworker, pool) != 0) break; // carry on with what we have
+		pool->nthread++;
+	}
+#endif
+}
+// help with any jobs left then wait for the workers to finish
+void zxpoolfinish(struct zxpool* pool) {
+	int i;
+	zxworker(pool);
+	for (i = 0; i < pool->nthread; i++) {
+#ifdef _WIN32
+		WaitForSingleObject(pool->thread[i], INFINITE);
+		CloseHandle(pool->thread[i]);
+#else
+		pthread_join(pool->thread[i], NULL);
+#endif
+	}
+#ifdef _WIN32
+	DeleteCriticalSection(&pool->lock);
+#else
+	pthread_mutex_destroy(&pool->lock);
+#endif
+}
+void zxpoollock(struct zxpool* pool) {
+#ifdef _WIN32
+	EnterCriticalSection(&pool->lock);
+#else
+	pthread_mutex_lock(&pool->lock);
+#endif
+}
+void zxpoolunlock(struct zxpool* pool) {
+#ifdef _WIN32
+	LeaveCriticalSection(&pool->lock);
+#else
+	pthread_mutex_unlock(&pool->lock);
+#endif
+}
+// compress one block
+void zxjobrun(struct zxpool* pool, void* arg) {
+	struct zxjob* job = (struct zxjob*)arg;
+	struct zxmatch mt = { 0 }; // kept so the default parser doesn't have to search again for -x
+	double t = zxclock();
+	(void)pool;
+	job->len = zxsccache(job->cache, job->fload, job->store, job->filesize, job->screen, &mt, job->parse, job->level, &job->cached);
+	job->time = zxclock() - t;
+	if (job->parse == PARSE_OPTIMAL) {
+		t = zxclock();
+		job->greedy = zxscgreedy(job->fload, job->filesize, job->screen, &mt, job->level);
+		job->gtime = zxclock() - t;
+	}
+	job->compare = mt.compare;
+	zxmatchfree(&mt);
+}
+// convert one snapshot file into a .mdr of the same name, snap is grown as needed and kept for the next one. "-" reads
+// the snapshot from stdin & writes the cartridge to stdout
+int zxconvert(const char* fz80, struct zxopt* opt, unsigned char** snap, int* snapmax, unsigned char* cart) {
+	struct zxopt o = *opt;
+	FILE* fp_out;
+	int i, filesize, n = strlen(fz80), isstream = strcmp(fz80, "-") == 0;
+	// z80 or sna?
+	if (!isstream && (o.sna = zxsnaptype(fz80)) < 0) return 1; // argument isn't .z80/sna or .Z80/SNA
+	//create ouput mdr name from input
+	char fname[256], fmdr[256]; // limit to 256chars
+	for (i = 0; i < n - 4 && i < 251; i++) fname[i] = fz80[i];
+	fname[i] = '\0';
+	strcpy(fmdr, fname);
+	strcat(fmdr, ".mdr");
+	if (o.name == NULL) o.name = isstream ? "stdin" : fname;
+	// read the whole snapshot in
+	if ((i = zxreadsnap(fz80, snap, snapmax, &filesize)) != 0) return i;
+	if (o.sna < 0) o.sna = zxsnapsniff(filesize);
+	if ((i = z80onmdr(*snap, filesize, cart, &o)) != 0) return i;
+	// create file and write cartridge
+	if (isstream) {
+		i = fwrite(cart, sizeof(unsigned char), MDRSIZE, stdout);
+		return fflush(stdout) != 0 || i != MDRSIZE ? 3 : 0;
+	}
+	if ((fp_out = fopen(fmdr, "wb")) == NULL) return 3; // cannot open mdr for write
+	i = fwrite(cart, sizeof(unsigned char), MDRSIZE, fp_out);
+	if (fclose(fp_out) != 0 || i != MDRSIZE) return 3;
+	return 0;
+}
+// convert several snapshots of one game into a single .mdr named after the first
+int zxconvertset(const char** fz80, int n, struct zxopt* opt, unsigned char* cart) {
+	struct zxopt o = *opt;
+	FILE* fp_out;
+	unsigned char* snap[ZXSETMAX] = { NULL };
+	int filesize[ZXSETMAX], sna[ZXSETMAX], snapmax, i, err = 0;
+	char fname[256], fmdr[256]; // limit to 256chars
+	if (n == 0) return 1;
+	if (n > ZXSETMAX) return 16;
+	for (i = 0; i < n && err == 0; i++) {
+		snapmax = 0;
+		if ((sna[i] = zxsnaptype(fz80[i])) < 0) err = 1;
+		else err = zxreadsnap(fz80[i], &snap[i], &snapmax, &filesize[i]);
+	}
+	if (err == 0) {
+		for (i = 0; i < strlen(fz80[0]) - 4 && i < 251; i++) fname[i] = fz80[0][i];
+		fname[i] = '\0';
+		strcpy(fmdr, fname);
+		strcat(fmdr, ".mdr");
+		if (o.name == NULL) o.name = fname;
+		err = z80onmdrset((const unsigned char**)snap, filesize, sna, n, cart, &o);
+	}
+	if (err == 0) {
+		if ((fp_out = fopen(fmdr, "wb")) == NULL) err = 3; // cannot open mdr for write
+		else {
+			i = fwrite(cart, sizeof(unsigned char), MDRSIZE, fp_out);
+			if (fclose(fp_out) != 0 || i != MDRSIZE) err = 3;
+		}
+	}
+	for (i = 0; i < n; i++) free(snap[i]);
+	return err;
+}
+// pack different games onto as few cartridges as they fit on, named after the first snapshot then _2, _3... Each is
+// converted on its own first to find how many sectors it takes, then biggest first into the first cartridge with room
+// gives how many cartridges are needed. The games are then shared out over that many, each onto the one with the most
+// room, so no cartridge is full & the last games on it don't end up in the gaps between the others' files. On a
+// cartridge the biggest goes first as it gets the sectors nearest to where they would be on its own
+int zxconvertpack(const char** fz80, int n, struct zxopt* opt, unsigned char* cart) {
+	struct zxopt o = *opt;
+	FILE* fp_out;
+	unsigned char** snap, * packsnap[ZXSETMAX];
+	const char* packtitle[ZXSETMAX];
+	char (*title)[32], fname[256], fmdr[256]; // limit to 256chars
+	int* filesize, * sna, * used, * order, * bin, * room, * count, * most, packsize[ZXSETMAX], packsna[ZXSETMAX];
+	int snapmax, i, j, k, m, nbin = 0, err = 0;
+	double secs;
+	if (n == 0) return 1;
+	snap = (unsigned char**)calloc(n, sizeof(unsigned char*));
+	title = (char(*)[32])malloc(n * sizeof(*title));
+	filesize = (int*)malloc(8 * n * sizeof(int));
+	if (snap == NULL || title == NULL || filesize == NULL) {
+		free(snap);
+		free(title);
+		free(filesize);
+		return 10;
+	}
+	sna = &filesize[n];
+	used = &filesize[2 * n];
+	order = &filesize[3 * n];
+	bin = &filesize[4 * n];
+	room = &filesize[5 * n];
+	count = &filesize[6 * n];
+	most = &filesize[7 * n];
+	// read each in & convert it on its own to find its size, the menu shows the name without the folder or .z80
+	o.log = NULL;
+	o.stats = NULL;
+	o.set = NULL;
+	for (i = 0; i < n && err == 0; i++) {
+		snapmax = 0;
+		if ((sna[i] = zxsnaptype(fz80[i])) < 0) err = 1;
+		else err = zxreadsnap(fz80[i], &snap[i], &snapmax, &filesize[i]);
+		for (j = k = strlen(fz80[i]) - 4; j > 0 && fz80[i][j - 1] != '/' && fz80[i][j - 1] != '\\'; j--);
+		for (m = 0; j + m < k && m < 28; m++) title[i][m] = fz80[i][j + m];
+		title[i][m] = '\0';
+		o.sna = sna[i];
+		o.name = title[i];
+		if (err == 0) err = z80onmdr(snap[i], filesize[i], cart, &o);
+		used[i] = zxcartused(cart);
+		order[i] = i;
+	}
+	// first fit decreasing, each cartridge has the menu & one sector for the last file to move on from
+	for (i = 1; i < n; i++) for (j = i; j > 0 && used[order[j]] > used[order[j - 1]]; j--) {
+		k = order[j];
+		order[j] = order[j - 1];
+		order[j - 1] = k;
+	}
+	for (i = 0; i < n && err == 0; i++) {
+		k = order[i];
+		for (j = 0; j < nbin && (room[j] < used[k] || count[j] == ZXSETMAX); j++);
+		if (j == nbin) {
+			room[nbin] = 252;
+			count[nbin++] = 0;
+		}
+		if (room[j] < used[k]) err = 11;
+		room[j] -= used[k];
+		count[j]++;
+		bin[k] = j;
+	}
+	for (j = 0; j < nbin; j++) {
+		room[j] = 252;
+		count[j] = 0;
+	}
+	for (i = 0; i < n && err == 0; i++) {
+		k = order[i];
+		for (j = 1, m = 0; j < nbin; j++) if (count[m] == ZXSETMAX || (count[j] < ZXSETMAX && room[j] > room[m])) m = j;
+		if (room[m] < used[k] || count[m] == ZXSETMAX) break; // doesn't share out, keep first fit
+		room[m] -= used[k];
+		count[m]++;
+		most[k] = m;
+	}
+	if (i == n) for (i = 0; i < n; i++) bin[i] = most[i];
+	// build each cartridge
+	o = *opt;
+	for (j = 0; j < nbin && err == 0; j++) {
+		for (i = m = 0; i < n; i++) {
+			k = order[i];
+			if (bin[k] != j) continue;
+			packsnap[m] = snap[k];
+			packsize[m] = filesize[k];
+			packsna[m] = sna[k];
+			packtitle[m++] = title[k];
+		}
+		for (i = 0; i < strlen(fz80[0]) - 4 && i < 246; i++) fname[i] = fz80[0][i];
+		fname[i] = '\0';
+		if (j) sprintf(&fname[i], "_%d", j + 1);
+		strcpy(fmdr, fname);
+		strcat(fmdr, ".mdr");
+		o.name = fname;
+		if ((err = z80onmdrpack((const unsigned char**)packsnap, packsize, packsna, packtitle, m, cart, &o)) != 0) break;
+		if ((fp_out = fopen(fmdr, "wb")) == NULL) err = 3; // cannot open mdr for write
+		else {
+			i = fwrite(cart, sizeof(unsigned char), MDRSIZE, fp_out);
+			if (fclose(fp_out) != 0 || i != MDRSIZE) err = 3;
+		}
+		zxlog(opt->log, "%s>", fmdr);
+		for (i = 0; i < m; i++) {
+			secs = z80onmdrgametime(cart, i + 1);
+			zxlog(opt->log, "%s%d:%.1fs", i ? "," : "", i + 1, secs);
+		}
+		zxlog(opt->log, "\n");
+	}
+	for (i = 0; i < n; i++) free(snap[i]);
+	free(snap);
+	free(title);
+	free(filesize);
+	return err;
+}
+// 1 for .sna, 0 for .z80 or -1 if it isn't either
+int zxsnaptype(const char* fz80) {
+	int n = strlen(fz80);
+	if (n < 4) return -1;
+	if (strcmp(&fz80[n - 4], ".sna") == 0 || strcmp(&fz80[n - 4], ".SNA") == 0) return 1;
+	if (strcmp(&fz80[n - 4], ".z80") == 0 || strcmp(&fz80[n - 4], ".Z80") == 0) return 0;
+	return -1;
+}
+// 1 if a snapshot read from stdin looks like a .sna, 0 for .z80. A .sna is always one of three sizes & a .z80 that
+// size is very unlikely as it is compressed
+int zxsnapsniff(int filesize) {
+	return filesize == 49179 || filesize == 131103 || filesize == 147487;
+}
+// read the whole snapshot in, snap is grown as needed. "-" reads stdin, which can't be sized first so it is read until
+// the end up to ZXSNAPMAX bytes. Returns 0 or the error code
+int zxreadsnap(const char* fz80, unsigned char** snap, int* snapmax, int* filesize) {
+	FILE* fp_in;
+	unsigned char* grow;
+	int i;
+	if (strcmp(fz80, "-") == 0) {
+		*filesize = 0;
+		do {
+			if (*filesize + 1 >= *snapmax) {
+				if (*snapmax > ZXSNAPMAX) return 2; // far too big for a snapshot
+				if ((grow = (unsigned char*)realloc(*snap, *snapmax + 65536)) == NULL) return 6;
+				*snap = grow;
+				*snapmax += 65536;
+			}
+			i = fread(*snap + *filesize, sizeof(unsigned char), *snapmax - 1 - *filesize, stdin);
+			*filesize += i;
+		} while (i > 0);
+		return ferror(stdin) || *filesize == 0 ? 2 : 0;
+	}
+	if ((fp_in = fopen(fz80, "rb")) == NULL) return 2; // cannot open snapshot for read
+	fseek(fp_in, 0, SEEK_END); // jump to the end of the file to get the length
+	*filesize = ftell(fp_in); // get the file size
+	rewind(fp_in);
+	if (*filesize + 1 > *snapmax) {
+		free(*snap);
+		*snapmax = 0;
+		if ((*snap = (unsigned char*)malloc(*filesize + 1)) == NULL) {
+			fclose(fp_in);
+			return 6;
+		}
+		*snapmax = *filesize + 1;
+	}
+	i = fread(*snap, sizeof(unsigned char), *filesize, fp_in);
+	fclose(fp_in);
+	return i == *filesize ? 0 : 2;
+}
+int zxbatchcmp(const void* a, const void* b) {
+	return strcmp(*(char* const*)a, *(char* const*)b);
+}
+// add a snapshot to the batch, if scan is set and it is a folder then add all the snapshots in it instead (in name order)
+void zxbatchadd(struct zxbatch* batch, const char* path, int scan) {
+	struct stat st;
+	int n, first = batch->nfile;
+	if (scan && stat(path, &st) == 0 && (st.st_mode & S_IFDIR)) {
+#ifdef _WIN32
+		WIN32_FIND_DATAA fd;
+		HANDLE h;
+		char pattern[1024];
+		snprintf(pattern, sizeof(pattern), "%s\\*", path);
+		if ((h = FindFirstFileA(pattern, &fd)) == INVALID_HANDLE_VALUE) return;
+		do {
+			char* name = fd.cFileName;
+#else
+		DIR* dir;
+		struct dirent* ent;
+		if ((dir = opendir(path)) == NULL) return;
+		while ((ent = readdir(dir)) != NULL) {
+			char* name = ent->d_name;
+#endif
+			char file[1024];
+			n = strlen(name);
+			if (n < 4 || (strcmp(&name[n - 4], ".z80") != 0 && strcmp(&name[n - 4], ".Z80") != 0 &&
+				strcmp(&name[n - 4], ".sna") != 0 && strcmp(&name[n - 4], ".SNA") != 0)) continue; // only snapshots
+			snprintf(file, sizeof(file), "%s/%s", path, name);
+			zxbatchadd(batch, file, 0);
+#ifdef _WIN32
+		} while (FindNextFileA(h, &fd));
+		FindClose(h);
+#else
+		}
+		closedir(dir);
+#endif
+		qsort(&batch->file[first], batch->nfile - first, sizeof(char*), zxbatchcmp);
+		return;
+	}
+	if (batch->nfile == batch->max) {
+		batch->max = batch->max ? batch->max * 2 : 256;
+		if ((batch->file = (char**)realloc(batch->file, batch->max * sizeof(char*))) == NULL) error(6);
+	}
+	if ((batch->file[batch->nfile] = (char*)malloc(strlen(path) + 1)) == NULL) error(6);
+	strcpy(batch->file[batch->nfile++], path);
+}
+// convert the whole batch on opt.threads workers then give a summary, returns the error of the first one that failed
+int zxbatchrunall(struct zxbatch* batch) {
+	struct zxpool pool;
+	struct zxbatchjob job[MAXTHREADS];
+	int i, ok = 0, count[ZXERRMAX + 1] = { 0 }, first = 0;
+	int threads = batch->opt.threads;
+	if (threads < 1) threads = 1;
+	if (threads > MAXTHREADS) threads = MAXTHREADS;
+	if (batch->nfile && (batch->err = (int*)malloc(batch->nfile * sizeof(int))) == NULL) error(6);
+	for (i = 0; i < batch->nfile; i++) batch->err[i] = 10; // if no worker could get a cartridge
+	batch->opt.threads = 1; // each one on a single thread, the batch is split across the threads instead
+	batch->opt.log = NULL;
+	batch->opt.cachekeep = 1; // tidied once the whole batch is done rather than by every worker after every snapshot
+	batch->next = 0;
+	for (i = 0; i < threads; i++) {
+		job[i].batch = batch;
+		job[i].snap = job[i].cart = NULL;
+		job[i].snapmax = 0;
+	}
+	zxpoolstart(&pool, job, sizeof(struct zxbatchjob), threads, threads - 1, zxbatchrun);
+	zxpoolfinish(&pool);
+	if (batch->opt.cache) zxcachetidy(batch->opt.cache, batch->opt.cachemax > 0 ? batch->opt.cachemax : ZXCACHEMAX);
+	for (i = 0; i < batch->nfile; i++) {
+		if (batch->err[i] == 0) ok++;
+		else {
+			count[batch->err[i] <= ZXERRMAX ? batch->err[i] : 0]++;
+			if (first == 0) first = batch->err[i];
+		}
+		free(batch->file[i]);
+	}
+	fprintf(stdout, "[B]%d>%d ok", batch->nfile, ok);
+	for (i = 1; i <= ZXERRMAX; i++) if (count[i]) fprintf(stdout, ",E%02d(%d)", i, count[i]);
+	fprintf(stdout, "\n");
+	free(batch->file);
+	free(batch->err);
+	return first;
+}
+// batch worker, converts snapshots until there are none left
+void zxbatchrun(struct zxpool* pool, void* arg) {
+	struct zxbatchjob* job = (struct zxbatchjob*)arg;
+	struct zxbatch* batch = job->batch;
+	int i, err;
+	if (job->cart == NULL && (job->cart = (unsigned char*)malloc(MDRSIZE * sizeof(unsigned char))) == NULL) return;
+	for (;;) {
+		zxpoollock(pool);
+		i = batch->next < batch->nfile ? batch->next++ : -1;
+		zxpoolunlock(pool);
+		if (i < 0) break;
+		err = zxconvert(batch->file[i], &batch->opt, &job->snap, &job->snapmax, job->cart);
+		zxpoollock(pool);
+		batch->err[i] = err;
+		if (err) fprintf(stdout, "%s[E%02d]\n", batch->file[i], err);
+		else fprintf(stdout, "%s>OK\n", batch->file[i]);
+		zxpoolunlock(pool);
+	}
+	free(job->snap);
+	free(job->cart);
+	job->snap = job->cart = NULL;
+}
+// next byte of the snapshot or EOF if past the end
+int zxgetc(struct zxin* in) {
+	if (in->pos >= in->size) return EOF;
+	return in->buf[in->pos++];
+}
+// copy the next size bytes of the snapshot, returns how many there were
+int zxread(struct zxin* in, unsigned char* out, int size) {
+	if (in->pos >= in->size) return 0;
+	if (size > in->size - in->pos) size = in->size - in->pos;
+	memcpy(out, &in->buf[in->pos], size);
+	in->pos += size;
+	return size;
+}
+// progress output, none if log is NULL
+void zxlog(FILE* log, const char* format, ...) {
+	va_list args;
+	if (log == NULL) return;
+	va_start(args, format);
+	vfprintf(log, format, args);
+	va_end(args);
+}
+// seconds from some fixed point
+double zxclock(void) {
+#ifdef _WIN32
+	LARGE_INTEGER t, f;
+	QueryPerformanceCounter(&t);
+	QueryPerformanceFrequency(&f);
+	return (double)t.QuadPart / (double)f.QuadPart;
+#else
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec + t.tv_nsec / 1e9;
+#endif
+}
+// most memory the whole process has used so far in KB
+long zxpeakmem(void) {
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS pmc;
+	if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) return 0;
+	return (long)(pmc.PeakWorkingSetSize / 1024);
+#else
+	struct rusage ru;
+	if (getrusage(RUSAGE_SELF, &ru)) return 0;
+#ifdef __APPLE__
+	return ru.ru_maxrss / 1024; // bytes on macOS
+#else
+	return ru.ru_maxrss;
+#endif
+#endif
+}
+// count the tokens in a compressed block, stops at the end marker or len bytes
+void zxtokens(const unsigned char* comp, unsigned long len, struct zxtok* tok) {
+	const unsigned char* end = comp + len;
+	int c, n, h;
+	while (comp < end && (c = *comp++) != 0xff) {
+		if (c < 0x20) { // literal run
+			tok->lit++;
+			tok->litbytes += c + 1;
+			comp += c + 1;
+			continue;
+		}
+		n = (c >> 5) + 2;
+		if (n == 9) { // long match
+			if (comp == end) break;
+			n += *comp++;
+			tok->longmatch++;
+		}
+		comp++; // offset low byte
+		tok->match++;
+		tok->matchbytes += n;
+		for (h = 0; n > 8 && h < ZXHIST - 6 - 1 && n > 16 << h; h++);
+		tok->hist[n < 9 ? n - 3 : h + 6]++;
+	}
+}
+// note the time taken by one zxsc call
+void zxstatcall(struct zxstats* st, const char* block, double time, int in, unsigned long out, int cached) {
+	if (st->ncall == ZXSTATCALL) return;
+	snprintf(st->call[st->ncall].block, sizeof(st->call[0].block), "%s", block);
+	st->call[st->ncall].time = time;
+	st->call[st->ncall].in = in;
+	st->call[st->ncall].out = out;
+	st->call[st->ncall].cached = cached;
+	st->ncall++;
+}
+// write the stats as one line of JSON, times are in ms. The sector map has one letter for each sector from 254 down
+// to 1, the first letter of the file in it or . if free. It is built up then written in one go so lines from
+// conversions on other threads don't get mixed up
+void zxstatsjson(FILE* fp, struct zxstats* st, const char* name, int err, double total, unsigned char* cart) {
+	static const char* histname[ZXHIST] = { "3", "4", "5", "6", "7", "8", "9-16", "17-32", "33-64", "65-128", "129+" };
+	char buf[ZXSTATCALL * 80 + 2048];
+	int i, n = 0;
+#define zxjson(...) n += snprintf(&buf[n], n < (int)sizeof(buf) ? sizeof(buf) - n : 0, __VA_ARGS__)
+	zxjson("{\"name\":\"");
+	for (i = 0; name != NULL && name[i] && n < 1024; i++) {
+		if (name[i] == '"' || name[i] == '\\') zxjson("\\%c", name[i]);
+		else if ((unsigned char)name[i] >= 0x20) zxjson("%c", name[i]);
+	}
+	zxjson("\",\"error\":%d,\"ms\":{\"total\":%.3f,\"header\":%.3f,\"decompress\":%.3f,\"gap\":%.3f,\"delta\":%.3f,"
+		"\"pagewait\":%.3f,\"assembly\":%.3f,\"verify\":%.3f},\"delta_iterations\":%d,\"zxsc\":[", err, total * 1000.0,
+		st->header * 1000.0, st->decomp * 1000.0, st->gap * 1000.0, st->delta * 1000.0, st->pagewait * 1000.0, st->assembly * 1000.0,
+		st->verify * 1000.0, st->ndelta);
+	for (i = 0; i < st->ncall; i++) {
+		zxjson("%s{\"block\":\"%s\",\"ms\":%.3f,\"in\":%d,\"out\":%lu,\"cached\":%d}", i ? "," : "", st->call[i].block,
+			st->call[i].time * 1000.0, st->call[i].in, st->call[i].out, st->call[i].cached);
+	}
+	zxjson("],\"compares\":%lu,\"tokens\":{\"literal_runs\":%lu,\"literal_bytes\":%lu,\"matches\":%lu,\"long_matches\":%lu,"
+		"\"match_bytes\":%lu},\"match_lengths\":{", st->compare, st->tok.lit, st->tok.litbytes, st->tok.match, st->tok.longmatch,
+		st->tok.matchbytes);
+	for (i = 0; i < ZXHIST; i++) zxjson("%s\"%s\":%lu", i ? "," : "", histname[i], st->tok.hist[i]);
+	zxjson("},\"peak_kb\":%ld", zxpeakmem());
+	if (cart != NULL) {
+		zxjson(",\"load_s\":%.2f,\"sectors\":\"", z80onmdrtime(cart));
+		for (i = 0; i < 254; i++) zxjson("%c", cart[i * 543 + 15] ? cart[i * 543 + 19] : '.');
+		zxjson("\"");
+	}
+	zxjson("}\n");
+#undef zxjson
+	fputs(buf, fp);
+	fflush(fp);
+}
 //
 void error(int errorcode) {
 	fprintf(stdout, "[E%02d]\n",errorcode);
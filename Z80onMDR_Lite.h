@@ -0,0 +1,55 @@
+// Z80onMDR_Lite - Z80 snapshot to Microdrive MDR image converter
+// Copyright (c) 2021, Tom Dalby
+// 
+// Z80onMDR_Lite is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// Z80onMDR_Lite is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with Z80onMDR_Lite. If not, see <http://www.gnu.org/licenses/>.
+//
+// ===============================================================
+// library use, build Z80onMDR_Lite.c with -DZ80ONMDR_LIB to leave out main() then call z80onmdr() with the snapshot
+// in memory. It fills in the cartridge image & returns 0, or the error code (E01-E17 as listed in Z80onMDR_Lite.c) if
+// it fails. Nothing is kept between calls so conversions can be run on as many threads as needed. z80onmdrset() puts
+// several snapshots of one game on one cartridge & z80onmdrpack() several games with a menu
+#ifndef Z80ONMDR_LITE_H
+#define Z80ONMDR_LITE_H
+#include <stdio.h>
+#define MDRSIZE 137923 // 254 sectors * 543 + write protect flag
+#define PARSE_GREEDY 0 // original cost to end parser
+#define PARSE_OPTIMAL 1 // exact smallest size
+#define PARSE_TSTATE 2 // exact shortest time to load & unpack
+struct zxopt {
+	int sna; // 1 if the snapshot is .sna, 0 if .z80
+	int oldl; // 1 to use the older in-screen launcher
+	int parse; // PARSE_GREEDY, PARSE_OPTIMAL or PARSE_TSTATE
+	int level; // compression level, 1 quickest to 9 smallest, 0 for the default 9
+	int threads; // threads to compress on, 1 for just the caller
+	const char* cache; // folder to keep compressed blocks in & reuse them from, NULL for none
+	long cachemax; // cache folder size limit in bytes, 0 for 64MB
+	int cachekeep; // 1 to leave the cache folder's size to the caller after each conversion, 0 to tidy it every time
+	int gap; // extra sectors after each file, 0 to work out each one from how long the Spectrum is busy in between
+	const char* name; // cartridge name is the first 10 letters & numbers of this, the command line's -n, NULL for a blank name
+	FILE* log; // progress output as the command line gives, NULL for none
+	FILE* stats; // time taken by each stage & compression counters as one line of JSON, NULL for none
+	int search; // launcher placements & starting deltas to try at once for the smallest main block, 0 or 1 for just the usual one
+	int verify; // 1 to read the cartridge back & check it against the snapshot, E17 if it doesn't match
+	struct zxset* set; // set by z80onmdrset() & z80onmdrpack(), NULL otherwise
+};
+int z80onmdr(const unsigned char* snapshot, int filesize, unsigned char* cart, struct zxopt* opt);
+// n snapshots (up to 9, sna[i] is 1 for .sna) sharing a cartridge, RUN loads the first & "run2" to "run9" the others
+int z80onmdrset(const unsigned char** snapshot, const int* filesize, const int* sna, int n, unsigned char* cart, struct zxopt* opt);
+// n different games (up to 9, title[i] is shown on the menu) on one cartridge, RUN gives a menu that loads "run1" to "run9"
+int z80onmdrpack(const unsigned char** snapshot, const int* filesize, const int* sna, const char** title, int n, unsigned char* cart, struct zxopt* opt);
+// estimated seconds from RUN to the game starting for a cartridge image made by z80onmdr(), -1 if it isn't one
+double z80onmdrtime(const unsigned char* cart);
+// the same from choosing game 1 to 9 on the menu of a cartridge made by z80onmdrpack(), 0 for the one RUN starts
+double z80onmdrgametime(const unsigned char* cart, int game);
+#endif